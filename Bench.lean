@@ -0,0 +1,538 @@
+import Tls
+import Http.Client
+import Std
+
+open Tls.Internal.FFI
+open Std.Internal.IO.Async
+open Std.Internal.IO.Async.TCP
+open Http
+
+/-!
+# `tls-bench`
+
+Measures the client stack against a TLS server on loopback, running in the same process
+with a freshly generated self-signed certificate.
+Every result is printed as one JSON object per line:
+```
+{"bench": "...", "value": ..., "unit": "...", "params": {...}}
+```
+Pass `--quick` for a short smoke run,
+`--crypto-pool` to run handshakes and large writes on the crypto worker pool,
+`--ktls` to run the bulk transfers over a native socket with kernel TLS (needs the `tls` module),
+and `--uring` to run the bulk transfers and requests over io_uring-driven sockets.
+-/
+
+namespace Bench
+
+structure Config where
+  handshakes : Nat := 500
+  bulkBytes : Nat := 64 * 1024 * 1024
+  chunkSizes : Array Nat := #[1024, 16 * 1024, 64 * 1024]
+  requests : Nat := 2000
+  idleConnections : Nat := 500
+  prewarm : Nat := 8
+  contexts : Nat := 200
+  serverShards : Nat := 4
+  /-- Bulk transfers over a native socket with kernel TLS, where available. -/
+  ktls : Bool := false
+  /-- Bulk transfers and requests over native sockets driven by io_uring, where available. -/
+  uring : Bool := false
+
+def Config.quick : Config :=
+  { handshakes := 20, bulkBytes := 1024 * 1024, requests := 50, idleConnections := 20, contexts := 20 }
+
+structure Result where
+  bench : String
+  value : Float
+  unit : String
+  params : Array (String × String) := #[]
+
+def Result.toJson (r : Result) : String :=
+  let params := r.params.toList.map fun (k, v) => s!"\"{k}\": \"{v}\""
+  s!"\{\"bench\": \"{r.bench}\", \"value\": {r.value}, \"unit\": \"{r.unit}\", \"params\": \{{", ".intercalate params}}}"
+
+def emit (r : Result) : IO Unit := do
+  let out ← IO.getStdout
+  out.putStrLn r.toJson
+  out.flush
+
+/-- Run `x` and return its result together with the elapsed seconds. -/
+def timed (x : Async α) : Async (α × Float) := do
+  let start ← IO.monoNanosNow
+  let a ← x
+  let stop ← IO.monoNanosNow
+  return (a, (stop - start).toFloat / 1e9)
+
+/-- Resident set size in bytes. Only available where `/proc` is; assumes 4 KiB pages. -/
+def residentBytes? : IO (Option Nat) := do
+  try
+    let statm ← IO.FS.readFile "/proc/self/statm"
+    return (statm.splitOn " ")[1]? >>= String.toNat? |>.map (· * 4096)
+  catch _ =>
+    return none
+
+/-! ## Wire protocol
+
+After the handshake the client either speaks HTTP/1.1,
+or sends 9-byte commands: an opcode followed by a big-endian 64-bit length `n`.
+* `P`: the server replies with one byte.
+* `D`: the server replies with `n` bytes.
+* `U`: the client sends `n` bytes, then the server replies with one byte.
+-/
+
+def encodeCommand (op : Char) (n : Nat) : ByteArray := Id.run do
+  let mut bs := ByteArray.emptyWithCapacity 9
+  bs := bs.push op.toUInt8
+  for i in [0:8] do
+    bs := bs.push (n >>> (8 * (7 - i))).toUInt8
+  return bs
+
+def decodeLength (bs : ByteArray) (off : Nat) : Nat := Id.run do
+  let mut n := 0
+  for i in [0:8] do
+    n := n * 256 + (bs.get! (off + i)).toNat
+  return n
+
+/-- Index just past the first `\r\n\r\n` in `bs`. -/
+def headerEnd? (bs : ByteArray) : Option Nat := Id.run do
+  if bs.size < 4 then
+    return none
+  for i in [0:bs.size - 3] do
+    if bs.get! i == 13 && bs.get! (i + 1) == 10 && bs.get! (i + 2) == 13 && bs.get! (i + 3) == 10 then
+      return some (i + 4)
+  return none
+
+def readChunk : USize := 64 * 1024
+
+/-- Read until `buf` holds at least `n` bytes, or `none` if the peer closed first. -/
+partial def fillTo (bio : BIO) (buf : ByteArray) (n : Nat) : Async (Option ByteArray) := do
+  if buf.size ≥ n then
+    return some buf
+  let (buf, got?) ← bio.readIntoAsync? buf readChunk
+  match got? with
+  | none | some 0 => return none
+  | some _ => fillTo bio buf n
+
+def zeros : ByteArray := ByteArray.mk (Array.replicate (64 * 1024) 0)
+
+/-- Send `n` bytes taken from `chunk`, one `chunk` per write. -/
+partial def sendBytes (bio : BIO) (chunk : ByteArray) (n : Nat) : Async Unit := do
+  if n == 0 then
+    return
+  let part := if n ≥ chunk.size then chunk else chunk.extract 0 n
+  bio.writeAsync part
+  sendBytes bio chunk (n - part.size)
+
+/-- Discard `n` bytes, the first of which are already in `buf`. Returns what was read past them. -/
+partial def skipBytes (bio : BIO) (buf : ByteArray) (n : Nat) : Async (Option ByteArray) := do
+  if buf.size ≥ n then
+    return some (buf.extract n buf.size)
+  let some next ← fillTo bio .empty 1 | return none
+  skipBytes bio next (n - buf.size)
+
+/-! ## Server -/
+
+def httpResponse : ByteArray :=
+  "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 2\r\n\r\nok".toUTF8
+
+def reply (bio : BIO) : Async Unit := do
+  bio.writeAsync (ByteArray.mk #[1])
+  bio.flushAsync
+
+/-- Serve commands or HTTP/1.1 requests until the peer closes. -/
+partial def serve (bio : BIO) (buf : ByteArray) : Async Unit := do
+  let some buf ← fillTo bio buf 1 | return
+  if buf.get! 0 == 'G'.toUInt8 then
+    match headerEnd? buf with
+    | some n =>
+      bio.writeAsync httpResponse
+      bio.flushAsync
+      serve bio (buf.extract n buf.size)
+    | none =>
+      let some buf ← fillTo bio buf (buf.size + 1) | return
+      serve bio buf
+  else
+    let some buf ← fillTo bio buf 9 | return
+    let op := buf.get! 0
+    let n := decodeLength buf 1
+    let rest := buf.extract 9 buf.size
+    if op == 'P'.toUInt8 then
+      reply bio
+      serve bio rest
+    else if op == 'D'.toUInt8 then
+      sendBytes bio zeros n
+      bio.flushAsync
+      serve bio rest
+    else if op == 'U'.toUInt8 then
+      let some rest ← skipBytes bio rest n | return
+      reply bio
+      serve bio rest
+
+/-- Listen on an ephemeral loopback port and serve in the background, one accept loop per shard. -/
+def startServer (cfg : Config) (records : Tls.RecordConfig := {}) : Async Std.Net.SocketAddress := do
+  let shards ← Tls.ServerConfig.buildShards
+    { cert := .selfSigned "localhost", alpnProtocols := #["http/1.1"], maxEarlyData := 16 * 1024, records }
+    cfg.serverShards (← TicketKeys.new)
+  let server ← Socket.Server.mk
+  server.bind (.v4 { addr := .ofParts 127 0 0 1, port := 0 })
+  server.listen 1024
+  let addr ← server.getSockName
+  Tls.serveShards server shards fun conn => serve conn.bio conn.earlyData
+  return addr
+
+/-! ## Benchmarks -/
+
+/-- One round trip. Also makes the client process the TLS 1.3 tickets sent after the handshake. -/
+def ping (bio : BIO) : Async Unit := do
+  bio.writeAsync (encodeCommand 'P' 0)
+  bio.flushAsync
+  discard <| fillTo bio .empty 1
+
+def benchHandshakes (cfg : Config) (addr : Std.Net.SocketAddress) (ctx : SSLContext) (resume : Bool) :
+    Async Unit := do
+  let cache ← SessionCache.new 16
+  let session? := if resume then some (cache, "bench") else none
+  if resume then
+    let conn ← Tls.connect addr ctx (session? := session?)
+    ping conn.bio
+    conn.shutdown
+  let (resumed, secs) ← timed do
+    let mut resumed := 0
+    for _ in [0:cfg.handshakes] do
+      let conn ← Tls.connect addr ctx (session? := session?)
+      ping conn.bio
+      if ← conn.bio.session_reused then
+        resumed := resumed + 1
+      conn.shutdown
+    return resumed
+  emit
+    { bench := if resume then "handshake_resumed" else "handshake_full"
+      value := cfg.handshakes.toFloat / secs
+      unit := "handshakes/s"
+      params := #[("count", toString cfg.handshakes), ("resumed", toString resumed)] }
+
+/-- Resumed connections whose first command goes out as 0-RTT early data, until its reply. -/
+def benchEarlyData (cfg : Config) (addr : Std.Net.SocketAddress) (ctx : SSLContext) : Async Unit := do
+  let cache ← SessionCache.new 16
+  let session? := some (cache, "early")
+  let conn ← Tls.connect addr ctx (session? := session?)
+  ping conn.bio
+  conn.shutdown
+  let (accepted, secs) ← timed do
+    let mut accepted := 0
+    for _ in [0:cfg.handshakes] do
+      let conn ← Tls.connect addr ctx (session? := session?) (earlyData? := some (encodeCommand 'P' 0))
+      discard <| fillTo conn.bio .empty 1
+      if (← conn.bio.early_data_status) == .accepted then
+        accepted := accepted + 1
+      conn.shutdown
+    return accepted
+  emit
+    { bench := "early_data_round_trip"
+      value := secs * 1e6 / cfg.handshakes.toFloat
+      unit := "us/connection"
+      params := #[("count", toString cfg.handshakes), ("accepted", toString accepted)] }
+
+/-- Read `n` bytes, at most `readSize` bytes per read. -/
+partial def drain (bio : BIO) (n : Nat) (readSize : USize) : Async Unit := do
+  if n == 0 then
+    return
+  let some bs ← bio.readAsync? readSize
+    | throw <| IO.userError "tls-bench: connection closed early"
+  drain bio (n - bs.size) readSize
+
+def benchBulk (cfg : Config) (addr : Std.Net.SocketAddress) (ctx : SSLContext) : Async Unit := do
+  let conn ← Tls.connect addr ctx (nativeSocket := cfg.ktls || cfg.uring) (ktls := cfg.ktls) (uring := cfg.uring)
+  let bio := conn.bio
+  let mode := #[("ktls_send", toString (← bio.ktls_send)), ("ktls_recv", toString (← bio.ktls_recv)),
+    ("uring", toString (cfg.uring && (← uring_available)))]
+  for size in cfg.chunkSizes do
+    let (_, secs) ← timed do
+      bio.writeAsync (encodeCommand 'D' cfg.bulkBytes)
+      bio.flushAsync
+      drain bio cfg.bulkBytes (USize.ofNat size)
+    emit
+      { bench := "download", value := cfg.bulkBytes.toFloat / secs / 1e6, unit := "MB/s"
+        params := #[("read_size", toString size), ("bytes", toString cfg.bulkBytes)] ++ mode }
+  for size in cfg.chunkSizes do
+    let chunk := ByteArray.mk (Array.replicate size 0)
+    let (_, secs) ← timed do
+      bio.writeAsync (encodeCommand 'U' cfg.bulkBytes)
+      sendBytes bio chunk cfg.bulkBytes
+      bio.flushAsync
+      discard <| fillTo bio .empty 1
+    emit
+      { bench := "upload", value := cfg.bulkBytes.toFloat / secs / 1e6, unit := "MB/s"
+        params := #[("write_size", toString size), ("bytes", toString cfg.bulkBytes)] ++ mode }
+  conn.shutdown
+
+/--
+Downloads with each TLS 1.3 cipher suite, and full handshakes with each key exchange group.
+The server accepts all of them, so the client's single choice decides.
+-/
+def benchSuites (cfg : Config) (addr : Std.Net.SocketAddress) : Async Unit := do
+  let aesHardware ← has_aes_hardware
+  for suite in #["TLS_AES_128_GCM_SHA256", "TLS_AES_256_GCM_SHA384", "TLS_CHACHA20_POLY1305_SHA256"] do
+    let ctx ← Tls.ContextConfig.build { verifyPeer := false, cipherSuites? := some suite }
+    let conn ← Tls.connect addr ctx
+    let (_, secs) ← timed do
+      conn.bio.writeAsync (encodeCommand 'D' cfg.bulkBytes)
+      conn.bio.flushAsync
+      drain conn.bio cfg.bulkBytes readChunk
+    emit
+      { bench := "suite_download", value := cfg.bulkBytes.toFloat / secs / 1e6, unit := "MB/s"
+        params := #[("suite", (← conn.bio.cipher_name).getD suite), ("aes_hardware", toString aesHardware)] }
+    conn.shutdown
+  for keyExchange in #[Tls.KeyExchange.x25519, .p256] do
+    let ctx ← Tls.ContextConfig.build { verifyPeer := false, protocol := { keyExchange } }
+    let (group, secs) ← timed do
+      let mut group := none
+      for _ in [0:cfg.handshakes] do
+        let conn ← Tls.connect addr ctx
+        ping conn.bio
+        group ← conn.bio.group_name
+        conn.shutdown
+      return group.getD "?"
+    emit
+      { bench := "handshake_group", value := cfg.handshakes.toFloat / secs, unit := "handshakes/s"
+        params := #[("group", group), ("count", toString cfg.handshakes)] }
+
+/--
+Time to the first byte of a 256 KB download, against servers with fixed and with dynamic record sizes,
+and downloads with client read-ahead.
+-/
+def benchRecords (cfg : Config) (addr dynamicAddr : Std.Net.SocketAddress) : Async Unit := do
+  let ctx ← Tls.ContextConfig.build { verifyPeer := false }
+  let size := 256 * 1024
+  for (dynamic, addr) in #[(false, addr), (true, dynamicAddr)] do
+    let conn ← Tls.connect addr ctx
+    ping conn.bio
+    let mut total := 0.0
+    for _ in [0:cfg.handshakes] do
+      let (first, secs) ← timed do
+        conn.bio.writeAsync (encodeCommand 'D' size)
+        conn.bio.flushAsync
+        let some bs ← conn.bio.readAsync? readChunk
+          | throw <| IO.userError "tls-bench: connection closed early"
+        return bs.size
+      total := total + secs
+      drain conn.bio (size - first) readChunk
+    emit
+      { bench := "download_first_byte", value := total * 1e6 / cfg.handshakes.toFloat, unit := "us"
+        params := #[("dynamic_records", toString dynamic), ("bytes", toString size)] }
+    conn.shutdown
+  for readAhead in #[0, 64 * 1024] do
+    let ctx ← Tls.ContextConfig.build { verifyPeer := false, records := { readAheadBuffer := readAhead } }
+    let conn ← Tls.connect addr ctx
+    let (_, secs) ← timed do
+      conn.bio.writeAsync (encodeCommand 'D' cfg.bulkBytes)
+      conn.bio.flushAsync
+      drain conn.bio cfg.bulkBytes readChunk
+    emit
+      { bench := "download", value := cfg.bulkBytes.toFloat / secs / 1e6, unit := "MB/s"
+        params := #[("read_ahead", toString readAhead), ("bytes", toString cfg.bulkBytes)] }
+    conn.shutdown
+
+/--
+Requests through `Http.HttpClient.mkTLS`, i.e. `Http.Transport.tls` end to end.
+Allocations are OpenSSL's only, and include the server side since it runs in this process.
+With `pooled`, connections are kept in a `Tls.Pool` pre-warmed with `prewarm` connections.
+-/
+def benchRequests (cfg : Config) (addr : Std.Net.SocketAddress) (port : UInt16) (pooled : Bool) :
+    Async Unit := do
+  let pool? ← if pooled then some <$> Tls.Pool.new else pure none
+  let client ← HttpClient.mkTLS "127.0.0.1" (port := port) (protocol := .http1_1)
+    (serverName? := none) (verify_peer := false) (pool? := pool?) (nativeSocket := cfg.uring) (uring := cfg.uring)
+  if pooled then
+    client.transport.prewarm addr cfg.prewarm
+  discard <| client.getAsync "/"
+  let allocsBefore ← alloc_stats
+  let mut samples : Array Float := #[]
+  for _ in [0:cfg.requests] do
+    let (_, secs) ← timed (client.getAsync "/")
+    samples := samples.push (secs * 1e6)
+  let allocsAfter ← alloc_stats
+  let sorted := samples.qsort (· < ·)
+  let percentile (p : Nat) : Float := sorted[min (sorted.size - 1) (sorted.size * p / 100)]!
+  let params := #[("requests", toString cfg.requests), ("pooled", toString pooled), ("uring", toString cfg.uring)]
+  emit { bench := "request_latency_p50", value := percentile 50, unit := "us", params }
+  emit { bench := "request_latency_p99", value := percentile 99, unit := "us", params }
+  if allocsAfter.count > 0 then
+    let perRequest (x : UInt64) : Float := x.toFloat / cfg.requests.toFloat
+    emit
+      { bench := "openssl_allocs_per_request"
+        value := perRequest (allocsAfter.count - allocsBefore.count), unit := "allocs", params }
+    emit
+      { bench := "openssl_alloc_bytes_per_request"
+        value := perRequest (allocsAfter.bytes - allocsBefore.bytes), unit := "bytes", params }
+
+/-- Resident memory per open, handshaken and idle connection, both ends included. -/
+def benchIdle (cfg : Config) (addr : Std.Net.SocketAddress) (ctx : SSLContext) (lowMemory : Bool) :
+    Async Unit := do
+  let some before ← residentBytes? | return
+  let liveBefore := (← alloc_stats).liveBytes
+  let mut conns : Array Tls.Connection := #[]
+  for _ in [0:cfg.idleConnections] do
+    let conn ← Tls.connect addr ctx
+    ping conn.bio
+    conns := conns.push conn
+  let some after ← residentBytes? | return
+  let liveAfter := (← alloc_stats).liveBytes
+  let mut buffers := 0
+  for conn in conns do
+    buffers := buffers + (← conn.bio.buffer_bytes).toNat
+  let n := cfg.idleConnections.toFloat
+  let params := #[("connections", toString cfg.idleConnections), ("low_memory", toString lowMemory)]
+  emit { bench := "idle_connection_memory", value := (after - before).toFloat / n, unit := "bytes/connection", params }
+  -- both ends live in this process, so these include the server side of each connection
+  emit { bench := "idle_openssl_heap", value := (liveAfter.toNat - liveBefore.toNat).toFloat / n
+         unit := "bytes/connection", params }
+  emit { bench := "idle_shim_buffers", value := buffers.toFloat / n, unit := "bytes/connection", params }
+  for conn in conns do
+    conn.shutdown
+
+/-- Distinct verifying client contexts, all sharing the system trust store. -/
+def benchContexts (cfg : Config) : Async Unit := do
+  let before := (← residentBytes?).getD 0
+  let (ctxs, secs) ← timed do
+    let mut ctxs := #[]
+    for i in [0:cfg.contexts] do
+      ctxs := ctxs.push (← Tls.ContextConfig.build { alpnProtocols := #[s!"bench-{i}"] })
+    return ctxs
+  let after := (← residentBytes?).getD 0
+  let params := #[("contexts", toString ctxs.size)]
+  emit { bench := "context_build", value := secs * 1e6 / cfg.contexts.toFloat, unit := "us/context", params }
+  emit { bench := "context_memory", value := (after - before).toFloat / cfg.contexts.toFloat
+         unit := "bytes/context", params }
+
+/--
+Pump a client and a server `Tls.Engine` against each other, handing each the ciphertext the other produced,
+until the client's handshake is done, it received `want` bytes of plaintext and the server sent all of `serverOut`.
+-/
+partial def pumpEngines (client server : Tls.Engine) (serverOut : ByteArray) (want : Nat)
+    (toClient toServer : ByteArray := .empty) (received : Nat := 0) : Async Nat := do
+  let c ← client.pump toClient
+  let toServer := toServer ++ c.ciphertext
+  let s ← server.pump toServer serverOut
+  let received := received + c.plaintext.size
+  let toClient := toClient.extract c.fed.toNat toClient.size ++ s.ciphertext
+  let toServer := toServer.extract s.fed.toNat toServer.size
+  let serverOut := serverOut.extract s.written.toNat serverOut.size
+  match c.status, s.status with
+  | .error e, _ | _, .error e => throw e
+  | .ok (), _ =>
+    if received ≥ want && serverOut.isEmpty then
+      return received
+  | _, _ => pure ()
+  if c.fed == 0 && s.fed == 0 && s.written == 0 && c.ciphertext.isEmpty && s.ciphertext.isEmpty then
+    throw <| IO.userError "tls-bench: engines stopped making progress"
+  pumpEngines client server serverOut want toClient toServer received
+
+/-- Client and server engines back to back in memory: no sockets, no tasks, one FFI call per `pump`. -/
+def benchEngine (cfg : Config) (clientCtx serverCtx : SSLContext) : Async Unit := do
+  let (_, secs) ← timed do
+    for _ in [0:cfg.handshakes] do
+      discard <| pumpEngines (← Tls.Engine.client clientCtx) (← Tls.Engine.server serverCtx) .empty 0
+  emit
+    { bench := "engine_handshake", value := cfg.handshakes.toFloat / secs, unit := "handshakes/s"
+      params := #[("count", toString cfg.handshakes)] }
+  let client ← Tls.Engine.client clientCtx
+  let server ← Tls.Engine.server serverCtx
+  discard <| pumpEngines client server .empty 0
+  let chunk := ByteArray.mk (Array.replicate (256 * 1024) 0)
+  let (_, secs) ← timed do
+    for _ in [0:cfg.bulkBytes / chunk.size] do
+      discard <| pumpEngines client server chunk chunk.size
+  emit
+    { bench := "engine_transfer", value := cfg.bulkBytes.toFloat / secs / 1e6, unit := "MB/s"
+      params := #[("pump_size", toString chunk.size), ("bytes", toString cfg.bulkBytes)] }
+
+/--
+Hashing and AEAD throughput in memory, and many short inputs hashed one call each
+against a single `hashMany` call.
+-/
+def benchCrypto (cfg : Config) : Async Unit := do
+  let chunk := ByteArray.mk (Array.replicate (256 * 1024) 0)
+  let rounds := cfg.bulkBytes / chunk.size
+  for alg in #[Tls.Crypto.DigestAlgorithm.sha256, .sha512, .blake2b512] do
+    let d ← Tls.Crypto.digest alg
+    let (_, secs) ← timed do
+      for _ in [0:rounds] do
+        d.update chunk
+      discard d.final
+    emit
+      { bench := "digest", value := (rounds * chunk.size).toFloat / secs / 1e6, unit := "MB/s"
+        params := #[("algorithm", alg.name), ("chunk_size", toString chunk.size)] }
+  let inputs := Array.replicate cfg.handshakes (ByteArray.mk (Array.replicate 1024 0))
+  for batched in [false, true] do
+    let (_, secs) ← timed do
+      if batched then
+        discard <| Tls.Crypto.hashMany .sha256 inputs
+      else
+        for input in inputs do
+          discard <| Tls.Crypto.hash .sha256 input
+    emit
+      { bench := "hash_small", value := secs * 1e9 / inputs.size.toFloat, unit := "ns/input"
+        params := #[("batched", toString batched), ("input_size", "1024"), ("count", toString inputs.size)] }
+  let nonce := ByteArray.mk (Array.replicate 12 0)
+  for alg in #[Tls.Crypto.AeadAlgorithm.aes128Gcm, .chacha20Poly1305] do
+    let key := ByteArray.mk (Array.replicate (if alg == .aes128Gcm then 16 else 32) 0)
+    let aead ← Aead.new alg.name key (encrypt := true)
+    let (_, secs) ← timed do
+      aead.start nonce
+      for _ in [0:rounds] do
+        discard <| aead.update chunk .empty
+      discard aead.seal_final
+    emit
+      { bench := "aead_seal", value := (rounds * chunk.size).toFloat / secs / 1e6, unit := "MB/s"
+        params := #[("algorithm", alg.name), ("aes_hardware", toString (← has_aes_hardware))] }
+
+/-- Process-wide TLS counters over the whole run, both ends included. -/
+def emitMetrics : IO Unit := do
+  let m ← global_metrics
+  let perHandshake (x : UInt64) : Float :=
+    if m.handshakes == 0 then 0 else x.toFloat / m.handshakes.toFloat
+  emit { bench := "handshake_cpu", value := perHandshake m.handshakeCpuNs / 1e3, unit := "us/handshake" }
+  emit { bench := "handshake_wait", value := perHandshake m.handshakeWaitNs / 1e3, unit := "us/handshake" }
+  emit { bench := "resumption_rate", value := m.resumptionRate, unit := "ratio" }
+  emit { bench := "retries", value := (m.retryRead + m.retryWrite + m.retryIOSpecial).toFloat, unit := "count" }
+  emit { bench := "task_polls_pending", value := m.taskPollsPending.toFloat, unit := "count"
+         params := #[("task_polls", toString m.taskPolls)] }
+  let u ← uring_stats
+  if u.submits > 0 then
+    emit { bench := "uring_entries_per_submit", value := u.entries.toFloat / u.submits.toFloat, unit := "entries"
+           params := #[("submits", toString u.submits), ("completions", toString u.completions)] }
+
+end Bench
+
+open Bench in
+def main (args : List String) : IO Unit := do
+  -- must come before anything allocates inside OpenSSL
+  discard <| enable_alloc_stats
+  let cfg : Config := if args.contains "--quick" then .quick else {}
+  let cfg := { cfg with ktls := args.contains "--ktls", uring := args.contains "--uring" }
+  if args.contains "--crypto-pool" then
+    CryptoPool.configure (workers := 4) (capacity := 1024) (writeThreshold := 64 * 1024)
+  let clientCtx ← Tls.ContextConfig.build { verifyPeer := false, alpnProtocols := #["http/1.1"] }
+  let lowMemoryCtx ← Tls.ContextConfig.build { verifyPeer := false, alpnProtocols := #["http/1.1"], lowMemory := true }
+  let engineServerCtx ← Tls.ServerConfig.build { cert := .selfSigned "localhost", alpnProtocols := #["http/1.1"] }
+  let run : Async Unit := do
+    let addr ← startServer cfg
+    let port := match addr with
+      | .v4 a => a.port
+      | .v6 a => a.port
+    benchHandshakes cfg addr clientCtx (resume := false)
+    benchHandshakes cfg addr clientCtx (resume := true)
+    benchEarlyData cfg addr clientCtx
+    benchBulk cfg addr clientCtx
+    benchSuites cfg addr
+    benchRecords cfg addr (← startServer cfg { dynamic? := some {} })
+    benchRequests cfg addr port (pooled := false)
+    benchRequests cfg addr port (pooled := true)
+    benchIdle cfg addr clientCtx (lowMemory := false)
+    benchIdle cfg addr lowMemoryCtx (lowMemory := true)
+    benchContexts cfg
+    benchEngine cfg clientCtx engineServerCtx
+    benchCrypto cfg
+  run.wait
+  emitMetrics
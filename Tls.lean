@@ -1,6 +1,12 @@
 module
 
 public import Tls.Internal.FFI
+public import Tls.Context
+public import Tls.Server
+public import Tls.Connection
+public import Tls.Engine
+public import Tls.Crypto
+public import Tls.Pool
 public import Http.Client
 
 open Tls.Internal.FFI
@@ -11,6 +17,35 @@ open System
 
 public section
 
+/-- Check the negotiated ALPN protocol and record it in `protocol`. -/
+private def checkALPN (protocol : IO.Ref Protocol) (requireALPN? : Option String) (tls : BIO) : Async Unit := do
+  let selected? ← tls.negotiatedALPN?
+  if let some selected := selected? then
+    match selected with
+    | "http/1.1" => protocol.set .http1_1
+    | "h2" => protocol.set .http2
+    | _ =>
+      protocol.set (.unrecognized selected)
+      throw <| IO.userError s!"TLS ALPN mismatch: negotiated {selected} is unrecognized"
+  else
+    protocol.set .unknown -- TODO: probe for protocol?
+    throw <| IO.userError s!"TLS ALPN failed: no negotiated protocol"
+  if let some expected := requireALPN? then
+    if selected? != some expected then
+      throw <| IO.userError s!"TLS ALPN mismatch: expected {expected}, negotiated {selected?.getD "<none>"}"
+
+/--
+See `Tls.connect` for `nativeSocket`, `ktls` and `uring`.
+Sessions in `session?` are cached under its key scoped to this transport's configuration,
+see `Tls.ContextConfig.scopeSessionKey`.
+With `pool?`, connections are taken from and returned to the pool instead of opened and closed every time.
+Only connections whose last request was answered without an error, and left no unread bytes, are returned.
+With `replaySafe?` and a fixed `requireALPN?`, a new connection is only opened by the first request,
+which goes out as 0-RTT early data if `replaySafe?` holds for its bytes and the session allows it.
+Rejected early data is sent again after the handshake.
+The predicate must only accept requests whose replay by an attacker is harmless, see RFC 8470.
+Such deferred connections are not opened by `prewarm` either.
+-/
 def Http.Transport.tls
   (protocol : IO.Ref Protocol)
   (requireALPN? : Option String)
@@ -18,67 +53,117 @@ def Http.Transport.tls
   (serverName? : Option String := none)
   (caCertFile? : Option String := none)
   (verify_peer : Bool := true)
+  (cipherList? : Option String := none)
+  (session? : Option (SessionCache × String) := none)
+  (nativeSocket : Bool := false)
+  (ktls : Bool := false)
+  (pool? : Option Tls.Pool := none)
+  (replaySafe? : Option (ByteArray → Bool) := none)
+  (caCertDir? : Option String := none)
+  (uring : Bool := false)
     : Transport where
   connect := fun addr => do
-    let sock ← Socket.Client.mk
-    let send (bs : ByteArray) : Async Unit := do
-      sock.send bs
-    let recv (size : USize) : Async ByteArray := do
-      match (← sock.recv? (UInt64.ofNat size.toNat)) with
-      | some d => return d
-      | none   => return ByteArray.empty
-    let stream : Stream := { send, recv, flush := pure () }
-    let outBIO ← BIO.ofStream stream
-    let meth ← SSLMethod.TLS
-    let ctx ← SSLContext.new meth
-    if verify_peer then
-      ctx.set_verify SSL_VERIFY_PEER
-    match caCertFile? with
-    | some path => ctx.load_verify_file path
-    | none => ctx.set_default_verify_paths
-    ctx.set_alpn_protocols alpnProtocols
-    let tls ← BIO.mkSSL ctx 1
-    if let some serverName := serverName? then
-      tls.set_sni serverName
-    let tls ← tls.push outBIO
-    let conn : Transport.Connection :=
-      { send := fun bytes => do
-          tls.writeAsync bytes
-          tls.flush
-        recv? := fun n => tls.readAsync? (USize.ofNat n.toNat)
-        shutdown := do
-          tls.ssl_shutdown
-          sock.shutdown
-        readBuffer := ← IO.mkRef {}
-      }
-    sock.connect addr
-    try
-      tls.handshakeAsync
-      let selected? ← tls.negotiatedALPN?
-      if let some selected := selected? then
-        match selected with
-        | "http/1.1" => protocol.set .http1_1
-        | "h2" => protocol.set .http2
-        | _ =>
-          protocol.set (.unrecognized selected)
-          throw <| IO.userError s!"TLS ALPN mismatch: negotiated {selected} is unrecognized"
-      else
-        protocol.set .unknown -- TODO: probe for protocol?
-        throw <| IO.userError s!"TLS ALPN failed: no negotiated protocol"
-      if let some expected := requireALPN? then
-        if selected? != some expected then
-          throw <| IO.userError s!"TLS ALPN mismatch: expected {expected}, negotiated {selected?.getD "<none>"}"
-      return conn
-    catch e =>
-      sock.shutdown
-      throw e
+    let cfg : Tls.ContextConfig := { caCertFile?, caCertDir?, verifyPeer := verify_peer, alpnProtocols, cipherList? }
+    let key := Tls.PoolKey.ofAddr addr serverName? cfg
+    let session? := session?.map fun (cache, key) => (cache, cfg.scopeSessionKey key)
+    let open_ (earlyData? : Option ByteArray) : Async Tls.Connection := do
+      let ctx ← Tls.ContextConfig.cached cfg
+      let c ← Tls.connect addr ctx serverName? session? nativeSocket ktls earlyData? uring
+      try
+        checkALPN protocol requireALPN? c.bio
+      catch e =>
+        c.closeTransport
+        throw e
+      return c
+    let reused? ← match pool? with
+      | some pool => pool.checkout? key
+      | none => pure none
+    let current ← IO.mkRef reused?
+    -- the framing of the first request must not depend on the handshake, hence the fixed ALPN
+    unless reused?.isSome || (replaySafe?.isSome && requireALPN?.isSome) do
+      current.set (some (← open_ none))
+    let connected : Async Tls.Connection := do
+      if let some c ← current.get then
+        return c
+      let c ← open_ none
+      current.set (some c)
+      return c
+    -- Only a connection whose last exchange completed goes back to the pool: after a failure, a closed read,
+    -- a request without any response read, or unread bytes, the old response may still arrive.
+    let clean ← IO.mkRef true
+    let awaiting ← IO.mkRef false
+    let readBuffer ← IO.mkRef ByteArray.empty
+    return {
+      send := fun bytes => do
+        awaiting.set true
+        try
+          if let some c ← current.get then
+            c.bio.writeAsync bytes
+            c.bio.flushAsync
+          else if replaySafe?.any fun safe => safe bytes then
+            current.set (some (← open_ (some bytes)))
+          else
+            let c ← connected
+            c.bio.writeAsync bytes
+            c.bio.flushAsync
+        catch e =>
+          clean.set false
+          throw e
+      recv? := fun n => do
+        try
+          let data? ← (← connected).bio.readAvailableAsync? (USize.ofNat n.toNat)
+          if data?.isSome then
+            awaiting.set false
+          else
+            clean.set false
+          return data?
+        catch e =>
+          clean.set false
+          throw e
+      shutdown := do
+        let some c ← current.get | return
+        let reusable := (← clean.get) && !(← awaiting.get) && (← readBuffer.get).isEmpty
+        match pool? with
+        | some pool => if reusable then pool.checkin key c else c.shutdown
+        | none => c.shutdown
+      readBuffer
+    }
+
+/--
+Open `n` connections to `addr` through `transport` at once, then shut them down again.
+With a pooled transport, see `Http.Transport.tls`, this leaves up to `n` handshaken connections waiting in the pool.
+-/
+def Http.Transport.prewarm (transport : Transport) (addr : Std.Net.SocketAddress) (n : Nat) : Async Unit := do
+  let pending ← (Array.range n).mapM fun _ => do
+    let promise ← IO.Promise.new (α := Except IO.Error Transport.Connection)
+    background do
+      try
+        promise.resolve (.ok (← transport.connect addr))
+      catch e =>
+        promise.resolve (.error e)
+    return promise
+  -- hold every connection until all are open, otherwise they would reuse each other
+  let mut conns := #[]
+  for promise in pending do
+    conns := conns.push (← Async.ofTask promise.result!)
+  for conn in conns do
+    conn.shutdown
 
 /--
 ## HTTPS client
-* If `caCertFile?` is `none`, the default path/files are used.
+* If `caCertFile?` and `caCertDir?` are `none`, the default path/files are used.
+  `caCertDir?` is a hashed directory whose certificates are only read when needed.
+  Trust stores are loaded once per process and shared, see `Tls.TrustSource.cached`.
 * If `serverName?` is `none`, SNI is disabled.
 * If `verify_peer` is `false`, verify is disabled.
 * Prefer specifying `protocol`.
+* `nativeSocket` selects the native socket fast path, and `ktls` kernel TLS or `uring` io_uring on top of it,
+  see `Tls.connect`.
+* If `resumeSessions` is `true`, sessions are cached in `Tls.defaultSessionCache` and resumed on later connections
+  with the same verification settings.
+* With `pool?`, idle connections are kept for later requests, see `Http.Transport.prewarm` to fill the pool up front.
+* With `replaySafe?`, the first request of a resumed connection goes out as 0-RTT early data
+  if the predicate accepts it, see `Http.Transport.tls`. This needs `resumeSessions` and a fixed `protocol`.
 -/
 def Http.HttpClient.mkTLS
   (host : String)
@@ -87,6 +172,13 @@ def Http.HttpClient.mkTLS
   (caCertFile? : Option String := none)
   (serverName? : Option String := some host)
   (verify_peer : Bool := true)
+  (resumeSessions : Bool := true)
+  (nativeSocket : Bool := false)
+  (ktls : Bool := false)
+  (pool? : Option Tls.Pool := none)
+  (replaySafe? : Option (ByteArray → Bool) := none)
+  (caCertDir? : Option String := none)
+  (uring : Bool := false)
     : BaseIO Http.HttpClient := do
   let (alpnProtocols, requireALPN?) :=
     match protocol with
@@ -95,5 +187,9 @@ def Http.HttpClient.mkTLS
     | .unknown => (#["http/1.1"], none)
     | .unrecognized x => (#[x], some x)
   let protocol ← IO.mkRef protocol
+  let session? :=
+    if resumeSessions then some (Tls.defaultSessionCache, Tls.sessionKey host port serverName?) else none
   let transport := Transport.tls protocol requireALPN? alpnProtocols serverName? caCertFile? verify_peer
+    (session? := session?) (nativeSocket := nativeSocket) (ktls := ktls) (pool? := pool?)
+    (replaySafe? := replaySafe?) (caCertDir? := caCertDir?) (uring := uring)
   return { host, port, protocol, transport }
@@ -0,0 +1,187 @@
+module
+
+public import Tls.Internal.FFI
+
+open Tls.Internal.FFI
+open Std.Internal.IO.Async
+open Std.Internal.IO.Async.TCP
+
+public section
+
+namespace Tls
+
+/-- The connected transport underneath the TLS BIO. -/
+private structure RawTransport where
+  bio : BIO
+  shutdown : Async Unit
+
+/-- Wrap a `Std` TCP socket as a generic stream BIO. -/
+private def RawTransport.ofClient (sock : Socket.Client) : IO RawTransport := do
+  let send (bs : ByteArray) : Async Unit := do
+    sock.send bs
+  let recv (size : USize) : Async ByteArray := do
+    match (← sock.recv? (UInt64.ofNat size.toNat)) with
+    | some d => return d
+    | none   => return ByteArray.empty
+  let stream : Stream := { send, recv, flush := pure () }
+  let bio ← BIO.ofStream stream
+  return { bio, shutdown := sock.shutdown }
+
+/-- Go through `Std`'s TCP socket, wrapped as a generic stream BIO. -/
+private def RawTransport.ofSocket (addr : Std.Net.SocketAddress) : Async RawTransport := do
+  let sock ← Socket.Client.mk
+  let raw ← RawTransport.ofClient sock
+  try
+    sock.connect addr
+  catch e =>
+    sock.shutdown
+    throw e
+  return raw
+
+/--
+Let OpenSSL drive the OS socket directly, bypassing the Lean closures of `BIO.ofStream`.
+With `uring`, the socket goes through the shim's io_uring instead of its poll loop.
+-/
+private def RawTransport.ofNativeSocket (addr : Std.Net.SocketAddress) (uring : Bool := false) :
+    Async RawTransport := do
+  let (host, port) := match addr with
+    | .v4 a => (toString a.addr, a.port)
+    | .v6 a => (toString a.addr, a.port)
+  let bio ← if uring then BIO.connectUringAsync host port else BIO.connectSocketAsync host port
+  return { bio, shutdown := do bio.socket_shutdown }
+
+/-- An established TLS connection. -/
+structure Connection where
+  /-- The SSL BIO, already pushed onto the transport. -/
+  bio : BIO
+  /-- Close the underlying transport without a TLS shutdown. -/
+  closeTransport : Async Unit
+  /-- Server side: the early data received before the handshake finished, to be handled before reading `bio`. -/
+  earlyData : ByteArray := .empty
+
+/-- Send `close_notify` and close the underlying transport. -/
+def Connection.shutdown (conn : Connection) : Async Unit := do
+  conn.bio.ssl_shutdown
+  conn.closeTransport
+
+/--
+Connect to `addr` and run the client handshake with `ctx`.
+* `serverName?` is sent as SNI.
+* `session?` resumes from, and stores new sessions into, a cache under the given key.
+  The key has to tell apart contexts that verify differently, see `ContextConfig.scopeSessionKey`.
+* If `nativeSocket` is `true`, the TLS BIO sits directly on a non-blocking OS socket
+  whose readiness is reported by the shim's event loop.
+  Otherwise it goes through `Std`'s TCP socket via `BIO.ofStream`.
+* If `ktls` is `true` as well, record encryption moves into the kernel where supported,
+  see `BIO.enable_ktls`. It is ignored without `nativeSocket`.
+* If `uring` is `true` as well, the socket is driven by an io_uring, see `BIO.uring_connect`.
+  It falls back to the event loop where io_uring is unavailable. Kernel TLS does not apply to it.
+* `earlyData?` is sent as TLS 1.3 early data (0-RTT) if `session?` resumes a session that allows it.
+  Otherwise, or if the server rejects it, it is sent right after the handshake, see `BIO.early_data_status`.
+  Only pass requests that are safe to replay.
+-/
+def connect (addr : Std.Net.SocketAddress) (ctx : SSLContext)
+    (serverName? : Option String := none)
+    (session? : Option (SessionCache × String) := none)
+    (nativeSocket : Bool := false)
+    (ktls : Bool := false)
+    (earlyData? : Option ByteArray := none)
+    (uring : Bool := false) : Async Connection := do
+  let uring := nativeSocket && uring && (← uring_available)
+  let tls ← BIO.mkSSL ctx 1
+  if nativeSocket && ktls && !uring then
+    tls.enable_ktls
+  if let some serverName := serverName? then
+    tls.set_sni serverName
+  if let some (cache, key) := session? then
+    tls.set_session_cache cache key
+  let raw ← if nativeSocket then RawTransport.ofNativeSocket addr uring else RawTransport.ofSocket addr
+  let tls ← tls.push raw.bio
+  try
+    if let some data := earlyData? then
+      if 0 < data.size && data.size ≤ (← tls.early_data_limit).toNat then
+        tls.writeEarlyDataAsync data
+    tls.handshakeAsync
+    if let some data := earlyData? then
+      if (← tls.early_data_status) != .accepted then
+        tls.writeAsync data
+      tls.flushAsync
+  catch e =>
+    raw.shutdown
+    throw e
+  return { bio := tls, closeTransport := raw.shutdown }
+
+/--
+Run the server handshake with `ctx` on an accepted client, see `ServerConfig.build`.
+The client is shut down if the handshake fails.
+Early data is only read if `ctx` accepts it, see `SSLContext.set_max_early_data`.
+-/
+def accept (client : Socket.Client) (ctx : SSLContext) : Async Connection := do
+  let raw ← RawTransport.ofClient client
+  let tls ← (← BIO.mkSSL ctx 0).push raw.bio
+  try
+    let earlyData ← tls.readEarlyDataAsync
+    tls.handshakeAsync
+    return { bio := tls, closeTransport := raw.shutdown, earlyData }
+  catch e =>
+    raw.shutdown
+    throw e
+
+/-- A failure in `serveShards`, which keeps serving after all of them. -/
+inductive ServeError where
+  /-- `accept` on the listening socket failed, e.g. with `EMFILE`. The loop backs off and accepts again. -/
+  | accept (err : IO.Error)
+  /-- A client failed the handshake. -/
+  | handshake (err : IO.Error)
+  /-- The handler of an established connection threw. -/
+  | handler (err : IO.Error)
+
+instance : ToString ServeError where
+  toString
+    | .accept e => s!"accept failed: {e}"
+    | .handshake e => s!"handshake failed: {e}"
+    | .handler e => s!"handler failed: {e}"
+
+/-- Report accept and handler failures on stderr. Failed handshakes are routine for public servers and dropped. -/
+def ServeError.report : ServeError → BaseIO Unit
+  | .handshake _ => pure ()
+  | e => discard <| (IO.eprintln s!"tls server: {e}").toBaseIO
+
+private def acceptBackoffMinMs : Nat := 10
+private def acceptBackoffMaxMs : Nat := 1000
+
+private partial def acceptLoop (server : Socket.Server) (ctx : SSLContext) (handler : Connection → Async Unit)
+    (onError : ServeError → BaseIO Unit) (backoffMs : Nat := 0) : Async Unit := do
+  let client ← try
+      pure (some (← server.accept))
+    catch e =>
+      onError (.accept e)
+      pure none
+  let some client := client
+    | -- out of descriptors or memory does not resolve itself instantly, so do not spin on it
+      let backoffMs := min acceptBackoffMaxMs (max acceptBackoffMinMs (2 * backoffMs))
+      sleep (.ofNat backoffMs)
+      acceptLoop server ctx handler onError backoffMs
+  background do
+    let conn ← try
+        pure (some (← accept client ctx))
+      catch e =>
+        onError (.handshake e)
+        pure none
+    if let some conn := conn then
+      try handler conn catch e => onError (.handler e)
+      conn.closeTransport
+  acceptLoop server ctx handler onError
+
+/--
+Serve `server` with one accept loop per context in `shards`, see `ServerConfig.buildShards`.
+Every accepted connection handshakes with its loop's context and runs `handler` in a task of its own,
+so handshakes spread over all threads of the task pool. Returns once the loops are started.
+Failures never stop a loop, they are passed to `onError`.
+-/
+def serveShards (server : Socket.Server) (shards : Array SSLContext) (handler : Connection → Async Unit)
+    (onError : ServeError → BaseIO Unit := ServeError.report) : Async Unit := do
+  for ctx in shards do
+    background (acceptLoop server ctx handler onError)
+
+end Tls
@@ -0,0 +1,248 @@
+module
+
+public import Tls.Internal.FFI
+
+open Tls.Internal.FFI
+
+public section
+
+namespace Tls
+
+/-- Where trusted CA certificates come from, see `TrustSource.cached`. -/
+inductive TrustSource where
+  /-- OpenSSL's default locations, see `TrustStore.system`. -/
+  | system
+  /-- A PEM bundle, parsed up front. -/
+  | file (path : String)
+  /-- A hashed directory, consulted on demand. -/
+  | dir (path : String)
+  deriving BEq, Hashable, Repr, Inhabited
+
+private initialize trustStoreCache : IO.Ref (Std.HashMap TrustSource TrustStore) ← IO.mkRef {}
+
+/--
+Get the process-wide trust store for `src`, loading it on first use.
+Every context built from the same source shares it, so a CA bundle is parsed and held once per process.
+-/
+def TrustSource.cached (src : TrustSource) : IO TrustStore := do
+  if let some store := (← trustStoreCache.get)[src]? then
+    return store
+  let store ← match src with
+    | .system => TrustStore.system
+    | .file path => TrustStore.loadFile path
+    | .dir path => TrustStore.loadDir path
+  trustStoreCache.modifyGet fun m =>
+    match m[src]? with
+    | some store' => (store', m)
+    | none => (store, m.insert src store)
+
+/-- A TLS protocol version, see `ProtocolConfig`. -/
+inductive TLSVersion where
+  | tls1_2
+  | tls1_3
+  deriving BEq, Hashable, Repr, Inhabited
+
+def TLSVersion.wire : TLSVersion → UInt16
+  | .tls1_2 => 0x0303
+  | .tls1_3 => 0x0304
+
+/-- Which AEAD comes first in the cipher order. -/
+inductive CipherPreference where
+  /-- OpenSSL's default order. -/
+  | default
+  /-- AES-GCM if the CPU accelerates it, see `has_aes_hardware`, ChaCha20-Poly1305 otherwise. -/
+  | auto
+  | aesGcm
+  | chacha20
+  deriving BEq, Hashable, Repr, Inhabited
+
+/-- Which group a client sends its key share for, OpenSSL's other default groups stay acceptable. -/
+inductive KeyExchange where
+  /-- OpenSSL's default groups. -/
+  | default
+  /-- The cheapest to compute. -/
+  | x25519
+  /-- For peers that require NIST curves. -/
+  | p256
+  deriving BEq, Hashable, Repr, Inhabited
+
+/--
+Protocol versions and algorithms, shared by `ContextConfig` and `ServerConfig`.
+* `minVersion?` and `maxVersion?` bound the negotiated version, OpenSSL's limits apply otherwise.
+* `ciphers` orders the AEADs of TLS 1.3 and 1.2 alike, ahead of OpenSSL's other defaults.
+  A server orders by its own preference then,
+  but with `auto` still lets clients that list ChaCha20-Poly1305 first have it.
+  An explicit `cipherList?` or `cipherSuites?` of the config overrides it.
+* `keyExchange` moves the preferred group in front of OpenSSL's defaults, `groups?` (OpenSSL list syntax) overrides it.
+* `sigalgs?` restricts the signature algorithms, in OpenSSL list syntax.
+-/
+structure ProtocolConfig where
+  minVersion? : Option TLSVersion := none
+  maxVersion? : Option TLSVersion := none
+  ciphers : CipherPreference := .default
+  keyExchange : KeyExchange := .default
+  groups? : Option String := none
+  sigalgs? : Option String := none
+  deriving BEq, Hashable, Repr, Inhabited
+
+private def aesGcmSuites := "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256"
+private def chachaSuites := "TLS_CHACHA20_POLY1305_SHA256:TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384"
+-- OpenSSL's default TLS 1.2 list, spelled out since `DEFAULT` is only recognized at the start.
+-- The preferred suites go in front, the rest keep their default order after them.
+private def defaultList := "ALL:!COMPLEMENTOFDEFAULT:!eNULL"
+private def aesGcmList :=
+  "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:ECDHE-ECDSA-AES256-GCM-SHA384:" ++
+  "ECDHE-RSA-AES256-GCM-SHA384:ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305:" ++ defaultList
+private def chachaList :=
+  "ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305:ECDHE-ECDSA-AES128-GCM-SHA256:" ++
+  "ECDHE-RSA-AES128-GCM-SHA256:ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384:" ++ defaultList
+-- OpenSSL's default groups after the first two, which `KeyExchange` orders.
+private def otherGroups := "X448:P-521:P-384:ffdhe2048:ffdhe3072:ffdhe4096:ffdhe6144:ffdhe8192"
+
+/-- Configure `ctx`, of a server if `server`, before the config's explicit cipher strings are applied. -/
+def ProtocolConfig.apply (cfg : ProtocolConfig) (ctx : SSLContext) (server : Bool) : IO Unit := do
+  if cfg.minVersion?.isSome || cfg.maxVersion?.isSome then
+    ctx.set_proto_versions (cfg.minVersion?.map (·.wire) |>.getD 0) (cfg.maxVersion?.map (·.wire) |>.getD 0)
+  let aesFirst ← match cfg.ciphers with
+    | .default => pure none
+    | .auto => some <$> has_aes_hardware
+    | .aesGcm => pure (some true)
+    | .chacha20 => pure (some false)
+  if let some aesFirst := aesFirst then
+    ctx.set_ciphersuites (if aesFirst then aesGcmSuites else chachaSuites)
+    ctx.set_cipher_list (if aesFirst then aesGcmList else chachaList)
+    if server then
+      ctx.set_server_cipher_preference (prioritizeChaCha := cfg.ciphers == .auto)
+  match cfg.groups?, cfg.keyExchange with
+  | some groups, _ => ctx.set_groups groups
+  | none, .x25519 => ctx.set_groups s!"X25519:P-256:{otherGroups}"
+  | none, .p256 => ctx.set_groups s!"P-256:X25519:{otherGroups}"
+  | none, .default => pure ()
+  if let some sigalgs := cfg.sigalgs? then
+    ctx.set_sigalgs sigalgs
+
+/-- Small records first, larger ones once a connection is busy, see `SSLContext.set_dynamic_records`. -/
+structure DynamicRecords where
+  /-- About one TCP segment, so a record never waits for a second one. -/
+  smallRecord : Nat := 1400
+  threshold : Nat := 1024 * 1024
+  idleMs : Nat := 1000
+  deriving BEq, Hashable, Repr, Inhabited
+
+/--
+How records are sized and read, shared by `ContextConfig` and `ServerConfig`.
+* `maxSendFragment?` caps the record size, see `SSLContext.set_max_send_fragment`.
+* `readAheadBuffer` bytes are read per `recv` if positive, see `SSLContext.set_read_ahead`.
+* `maxPipelines?` encrypts records in parallel where the cipher supports it, see `SSLContext.set_max_pipelines`.
+* `dynamic?` starts connections with small records, for a short time to first byte,
+  and switches to full records for bulk transfers.
+-/
+structure RecordConfig where
+  maxSendFragment? : Option Nat := none
+  readAheadBuffer : Nat := 0
+  maxPipelines? : Option Nat := none
+  dynamic? : Option DynamicRecords := none
+  deriving BEq, Hashable, Repr, Inhabited
+
+def RecordConfig.apply (cfg : RecordConfig) (ctx : SSLContext) : IO Unit := do
+  if let some len := cfg.maxSendFragment? then
+    ctx.set_max_send_fragment (USize.ofNat len)
+  if cfg.readAheadBuffer > 0 then
+    ctx.set_read_ahead (USize.ofNat cfg.readAheadBuffer)
+  if let some n := cfg.maxPipelines? then
+    ctx.set_max_pipelines (USize.ofNat n)
+  if let some d := cfg.dynamic? then
+    ctx.set_dynamic_records (USize.ofNat d.smallRecord) (UInt64.ofNat d.threshold) (UInt32.ofNat d.idleMs)
+
+/--
+Everything that determines how a client `SSLContext` is configured.
+Connections with equal configurations share one context.
+* `cipherList?` configures TLS 1.2 and below (OpenSSL cipher list syntax).
+* `cipherSuites?` configures TLS 1.3.
+* `protocol` bounds versions and orders ciphers and groups, see `ProtocolConfig`.
+* `caCertDir?` is a hashed CA directory read on demand, and takes precedence over `caCertFile?`.
+  With neither, OpenSSL's default locations are used.
+* `records` sizes records and read-ahead, see `RecordConfig`.
+* `lowMemory` trades some CPU for a smaller idle connection, see `SSLContext.set_low_memory`.
+-/
+structure ContextConfig where
+  caCertFile? : Option String := none
+  caCertDir? : Option String := none
+  verifyPeer : Bool := true
+  alpnProtocols : Array String := #[]
+  cipherList? : Option String := none
+  cipherSuites? : Option String := none
+  protocol : ProtocolConfig := {}
+  records : RecordConfig := {}
+  lowMemory : Bool := false
+  deriving BEq, Hashable, Repr, Inhabited
+
+def ContextConfig.trustSource (cfg : ContextConfig) : TrustSource :=
+  match cfg.caCertDir?, cfg.caCertFile? with
+  | some dir, _ => .dir dir
+  | none, some file => .file file
+  | none, none => .system
+
+/-- Build a fresh client context. Prefer `ContextConfig.cached`. -/
+def ContextConfig.build (cfg : ContextConfig) : IO SSLContext := do
+  let meth ← SSLMethod.TLS
+  let ctx ← SSLContext.new meth
+  ctx.set_verify (if cfg.verifyPeer then SSL_VERIFY_PEER else SSL_VERIFY_NONE)
+  -- without verification there is nothing to load the CA certificates for
+  if cfg.verifyPeer then
+    ctx.set_trust_store (← cfg.trustSource.cached)
+  cfg.protocol.apply ctx (server := false)
+  if let some ciphers := cfg.cipherList? then
+    ctx.set_cipher_list ciphers
+  if let some suites := cfg.cipherSuites? then
+    ctx.set_ciphersuites suites
+  ctx.set_alpn_protocols cfg.alpnProtocols
+  ctx.enable_client_session_cache
+  cfg.records.apply ctx
+  if cfg.lowMemory then
+    ctx.set_low_memory true
+  return ctx
+
+private initialize contextCache : IO.Ref (Std.HashMap ContextConfig SSLContext) ← IO.mkRef {}
+
+/--
+Get the process-wide context for `cfg`, building it on first use.
+A cached context is never reconfigured, so it is safe to share between connections and threads.
+-/
+def ContextConfig.cached (cfg : ContextConfig) : IO SSLContext := do
+  if let some ctx := (← contextCache.get)[cfg]? then
+    return ctx
+  let ctx ← cfg.build
+  -- another thread may have built the same configuration meanwhile, first insertion wins
+  contextCache.modifyGet fun m =>
+    match m[cfg]? with
+    | some ctx' => (ctx', m)
+    | none => (ctx, m.insert cfg ctx)
+
+/--
+Drop all cached contexts and trust stores, e.g. to pick up changed CA files.
+Connections that are still open keep their own reference.
+-/
+def ContextConfig.clearCache : BaseIO Unit := do
+  contextCache.set {}
+  trustStoreCache.set {}
+
+/-- Maximum number of sessions kept by `defaultSessionCache`. -/
+def defaultSessionCacheCapacity : USize := 1024
+
+/-- The process-wide client session cache used by `Http.HttpClient.mkTLS`. -/
+initialize defaultSessionCache : SessionCache ← SessionCache.new defaultSessionCacheCapacity
+
+/-- The key a session is cached under, see `ContextConfig.scopeSessionKey`. -/
+def sessionKey (host : String) (port : UInt16) (serverName? : Option String) : String :=
+  s!"{host}:{port}/{serverName?.getD ""}"
+
+/--
+Restrict `key` to connections made with `cfg`.
+A resumed session skips certificate verification, so a session established without verification,
+or against other CA certificates, must never be resumed by a client that verifies differently.
+-/
+def ContextConfig.scopeSessionKey (cfg : ContextConfig) (key : String) : String :=
+  s!"{key}#{reprStr cfg}"
+
+end Tls
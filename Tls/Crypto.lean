@@ -0,0 +1,94 @@
+module
+
+public import Tls.Internal.FFI
+
+open Tls.Internal.FFI (Digest Mac Aead constant_time_eq hash_many)
+
+public section
+
+namespace Tls.Crypto
+
+inductive DigestAlgorithm where
+  | sha256
+  | sha512
+  | blake2b512
+  | blake2s256
+  deriving BEq, Hashable, Repr, Inhabited
+
+/-- The name OpenSSL fetches the algorithm by. -/
+def DigestAlgorithm.name : DigestAlgorithm → String
+  | .sha256 => "SHA256"
+  | .sha512 => "SHA512"
+  | .blake2b512 => "BLAKE2b512"
+  | .blake2s256 => "BLAKE2s256"
+
+inductive AeadAlgorithm where
+  | aes128Gcm
+  | aes256Gcm
+  | chacha20Poly1305
+  deriving BEq, Hashable, Repr, Inhabited
+
+def AeadAlgorithm.name : AeadAlgorithm → String
+  | .aes128Gcm => "AES-128-GCM"
+  | .aes256Gcm => "AES-256-GCM"
+  | .chacha20Poly1305 => "ChaCha20-Poly1305"
+
+/-- Bytes of the tags appended by `seal`. -/
+def tagSize : Nat := 16
+
+/-- A streaming digest, see `Internal.FFI.Digest`. -/
+def digest (alg : DigestAlgorithm) : IO Digest :=
+  Digest.new alg.name
+
+def hash (alg : DigestAlgorithm) (data : ByteArray) : IO ByteArray := do
+  let d ← Digest.new alg.name
+  d.update data
+  d.final
+
+/-- The digest of each input, in one FFI call. Cheaper than `hash` per input for many short ones. -/
+def hashMany (alg : DigestAlgorithm) (inputs : Array ByteArray) : IO (Array ByteArray) :=
+  hash_many alg.name inputs
+
+/-- A streaming HMAC, see `Internal.FFI.Mac`. -/
+def hmacState (alg : DigestAlgorithm) (key : ByteArray) : IO Mac :=
+  Mac.hmac alg.name key
+
+def hmac (alg : DigestAlgorithm) (key data : ByteArray) : IO ByteArray := do
+  let m ← Mac.hmac alg.name key
+  m.update data
+  m.final
+
+/-- Whether `mac` is the HMAC of `data`, compared in constant time. -/
+def verifyHmac (alg : DigestAlgorithm) (key data mac : ByteArray) : IO Bool :=
+  return constant_time_eq (← hmac alg key data) mac
+
+/-- Whether `data` hashes to `expected`, compared in constant time. -/
+def verifyHash (alg : DigestAlgorithm) (data expected : ByteArray) : IO Bool :=
+  return constant_time_eq (← hash alg data) expected
+
+/--
+Encrypt `plaintext` and authenticate it together with `aad`. Returns the ciphertext followed by the tag.
+For many messages under one key, keep an `Internal.FFI.Aead` instead.
+-/
+def seal (alg : AeadAlgorithm) (key nonce : ByteArray) (plaintext : ByteArray) (aad : ByteArray := .empty) :
+    IO ByteArray := do
+  let aead ← Aead.new alg.name key (encrypt := true)
+  aead.start nonce
+  aead.aad aad
+  let out ← aead.update plaintext (ByteArray.emptyWithCapacity (plaintext.size + tagSize))
+  return out ++ (← aead.seal_final)
+
+/-- The plaintext of a `seal` result, or `none` if it or `aad` was tampered with. -/
+def unseal? (alg : AeadAlgorithm) (key nonce : ByteArray) (sealed : ByteArray) (aad : ByteArray := .empty) :
+    IO (Option ByteArray) := do
+  if sealed.size < tagSize then
+    return none
+  let aead ← Aead.new alg.name key (encrypt := false)
+  aead.start nonce
+  aead.aad aad
+  let plaintext ← aead.update (sealed.extract 0 (sealed.size - tagSize)) .empty
+  if ← aead.open_final (sealed.extract (sealed.size - tagSize) sealed.size) then
+    return some plaintext
+  return none
+
+end Tls.Crypto
@@ -0,0 +1,67 @@
+module
+
+public import Tls.Internal.FFI
+
+open Tls.Internal.FFI (BIO SSLContext SessionCache)
+
+public section
+
+namespace Tls
+
+/--
+A TLS connection that does no I/O of its own, for event loops that move the bytes themselves.
+Received ciphertext goes in and ciphertext to send comes out as `ByteArray`s,
+so many connections can be driven in batches without a Lean task per record.
+-/
+structure Engine where
+  raw : Internal.FFI.Engine
+  /-- The SSL BIO, for configuration and inspection, e.g. `BIO.negotiatedALPN?` or `BIO.session_reused`. -/
+  bio : BIO
+
+/--
+A client engine. Nothing is sent until the first `pump`, which yields the ClientHello.
+* `serverName?` is sent as SNI.
+* `session?` resumes from, and stores new sessions into, a cache under the given key.
+-/
+def Engine.client (ctx : SSLContext)
+    (serverName? : Option String := none)
+    (session? : Option (SessionCache × String) := none) : IO Engine := do
+  let raw ← Internal.FFI.Engine.new ctx (client := true)
+  let bio ← raw.bio
+  if let some serverName := serverName? then
+    bio.set_sni serverName
+  if let some (cache, key) := session? then
+    bio.set_session_cache cache key
+  return { raw, bio }
+
+/-- A server engine, see `ServerConfig.build`. -/
+def Engine.server (ctx : SSLContext) : IO Engine := do
+  let raw ← Internal.FFI.Engine.new ctx (client := false)
+  return { raw, bio := ← raw.bio }
+
+/--
+Hand over received ciphertext from `offset` on.
+Returns how many bytes were taken, the rest has to wait until a `pump` made room.
+-/
+def Engine.feed (engine : Engine) (ciphertext : ByteArray) (offset : USize := 0) : BaseIO USize :=
+  engine.raw.feed ciphertext offset
+
+/-- Append the ciphertext waiting to be sent, at most `max` bytes, to `buf`. -/
+def Engine.drain (engine : Engine) (buf : ByteArray := .empty) (max : USize := USize.ofNat (64 * 1024)) :
+    BaseIO ByteArray :=
+  engine.raw.drain buf max
+
+/--
+Move as much as possible in one call, see `Internal.FFI.Engine.pump`:
+`input` is received ciphertext and `output` plaintext to send, of which `fed` and `written` bytes were taken.
+Pass the previous `plaintext` and `ciphertext` buffers back in, emptied, to reuse them.
+-/
+def Engine.pump (engine : Engine) (input : ByteArray := .empty) (output : ByteArray := .empty)
+    (plaintext ciphertext : ByteArray := .empty) : BaseIO Internal.FFI.Engine.Pump :=
+  engine.raw.pump input output plaintext ciphertext
+
+/-- Queue a `close_notify`, which the next `pump` or `drain` yields. -/
+def Engine.close (engine : Engine) : BaseIO Unit :=
+  engine.bio.ssl_shutdown
+
+end Tls
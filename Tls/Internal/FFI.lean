@@ -15,6 +15,13 @@ namespace Tls.Internal.FFI
 declare_ffi_type% SSLMethod : Type
 declare_ffi_type% SSLContext : Type
 declare_ffi_type% BIO : Type
+declare_ffi_type% SessionCache : Type
+declare_ffi_type% TicketKeys : Type
+declare_ffi_type% TrustStore : Type
+declare_ffi_type% Engine : Type
+declare_ffi_type% Digest : Type
+declare_ffi_type% Mac : Type
+declare_ffi_type% Aead : Type
 
 @[extern "ssl_tls_method"]
 opaque SSLMethod.TLS : BaseIO SSLMethod
@@ -32,14 +39,83 @@ structure Stream : Type where
 @[extern "bio_of_stream"]
 opaque BIO.ofStream : Stream -> IO BIO
 
+/-!
+The transport tasks a stream BIO in the chain is waiting for.
+They are only observed here, the BIO still consumes their results on the next call.
+-/
+
+@[extern "bio_pending_recv_task"]
+opaque BIO.pending_recv_task : @& BIO -> BaseIO (Option (Task (Except IO.Error ByteArray)))
+
+@[extern "bio_pending_send_task"]
+opaque BIO.pending_send_task : @& BIO -> BaseIO (Option (Task (Except IO.Error Unit)))
+
+@[extern "bio_pending_flush_task"]
+opaque BIO.pending_flush_task : @& BIO -> BaseIO (Option (Task (Except IO.Error Unit)))
+
+/--
+Start a non-blocking TCP connect to a numeric IPv4/IPv6 address and wrap the socket as a BIO.
+The connect has finished once the socket is writable, see `BIO.socket_finish_connect`.
+-/
+@[extern "bio_socket_connect"]
+opaque BIO.socket_connect : String -> UInt16 -> IO BIO
+
+/-- Throw if the connect started by `BIO.socket_connect` failed. -/
+@[extern "bio_socket_finish_connect"]
+opaque BIO.socket_finish_connect : @& BIO -> IO Unit
+
+@[extern "bio_socket_shutdown"]
+opaque BIO.socket_shutdown : @& BIO -> BaseIO Unit
+
+/--
+Run `wake` once the socket in the chain is readable (or writable if `write`).
+Returns `false` without registering anything if the chain has no socket BIO.
+-/
+@[extern "bio_socket_wait"]
+opaque BIO.socket_wait : @& BIO -> (write : Bool) -> (wake : BaseIO Unit) -> BaseIO Bool
+
+/--
+Like `BIO.socket_connect`, but the socket is driven by an io_uring shared by all such BIOs:
+receives are multishot into a ring of provided buffers and the sends of all connections are batched.
+The connect has finished once `BIO.socket_wait` reports it writable. Throws if `uring_available` is `false`.
+-/
+@[extern "bio_uring_connect"]
+opaque BIO.uring_connect : String -> UInt16 -> IO BIO
+
+/-- Whether the kernel supports the io_uring features `BIO.uring_connect` needs. -/
+@[extern "uring_available"]
+opaque uring_available : BaseIO Bool
+
+/-- Counters of the io_uring behind `BIO.uring_connect`, since the process started. -/
+structure UringStats where
+  /-- Number of `io_uring_enter` calls that submitted entries. -/
+  submits : UInt64
+  /-- Entries submitted over all of them. -/
+  entries : UInt64
+  /-- Completions handled, a multishot receive completes once per received chunk. -/
+  completions : UInt64
+  deriving Repr, Inhabited
+
+@[extern "uring_stats"]
+opaque uring_stats : BaseIO UringStats
+
 @[extern "ssl_errors"]
 opaque errors : BaseIO (Array String)
 
 -- there is a lifetime issue with a pair
 -- it remains to see whether one half (asymmetrically) should keep the other alive
+-- `Engine` owns both halves of its pair instead
 @[extern "bio_new_pair"]
 private opaque BIO.mkPair : IO (BIO × BIO)
 
+/--
+Two ends of an in-memory connection: bytes written to one end are read from the other.
+Each end keeps the shared buffers alive, so the ends can be dropped in any order.
+Reading from an empty end would-block until the other end writes, and reports end of stream once it is dropped.
+-/
+@[extern "bio_new_loopback_pair"]
+opaque BIO.mkLoopbackPair : IO (BIO × BIO)
+
 @[extern "bio_mem"]
 opaque BIO.mkMem : IO BIO
 
@@ -49,6 +125,17 @@ opaque BIO.mkBuffer : IO BIO
 @[extern "bio_base64"]
 opaque BIO.mkBase64 : IO BIO
 
+/--
+A filter that hashes everything read or written through it with the digest `algorithm`, e.g. `SHA256`.
+Pushed on top of an SSL BIO it hashes the plaintext, see `BIO.digest_final`.
+-/
+@[extern "bio_md"]
+opaque BIO.mkDigest : (algorithm : @& String) -> IO BIO
+
+/-- The digest of the first message digest BIO in the chain, which then starts over. -/
+@[extern "bio_md_final"]
+opaque BIO.digest_final : @& BIO -> IO ByteArray
+
 @[extern "bio_push"]
 opaque BIO.push : BIO -> BIO -> BaseIO BIO
 
@@ -64,6 +151,145 @@ opaque BIO.write : @& BIO -> ByteArray -> IO Unit
 @[extern "bio_flush"]
 opaque BIO.flush : @& BIO -> IO Unit
 
+/--
+Outcome of a non-blocking BIO operation. Would-block is an ordinary result rather than an exception:
+the nullary constructors are boxed scalars on the C side, so reporting them allocates nothing.
+* `closed` is a failure without a retry flag and without a queued OpenSSL error, e.g. a close_notify.
+-/
+inductive BIO.Status (α : Type) where
+  | ok (value : α)
+  | wantRead
+  | wantWrite
+  | wantIOSpecial
+  | closed
+  | error (err : IO.Error)
+  deriving Inhabited
+
+@[extern "bio_read_status"]
+opaque BIO.readStatus : @& BIO -> USize -> BaseIO (BIO.Status ByteArray)
+
+/--
+Append at most `max` bytes to `buf`, in place when `buf` is uniquely referenced.
+Returns the (possibly reallocated) buffer and the number of bytes appended.
+Reuse the returned buffer for the next call to avoid allocating.
+-/
+@[extern "bio_read_into"]
+opaque BIO.readInto : @& BIO -> ByteArray -> USize -> BaseIO (ByteArray × BIO.Status USize)
+
+/--
+Read at most `max` bytes, then keep reading as long as the chain has buffered data
+(e.g. all decrypted records pending in an SSL BIO), all in one call. Only the first read may block.
+-/
+@[extern "bio_read_available"]
+opaque BIO.readAvailable : @& BIO -> USize -> BaseIO (BIO.Status ByteArray)
+
+/-- Returns the number of bytes accepted. After a retry status, the same `ByteArray` must be passed again. -/
+@[extern "bio_write_status"]
+opaque BIO.writeStatus : @& BIO -> @& ByteArray -> BaseIO (BIO.Status USize)
+
+/--
+Write the concatenation of `parts`, skipping its first `offset` bytes, packed into full-size TLS records.
+Returns the number of bytes accepted, which may be less than requested;
+resume by calling again with `offset` advanced by that amount.
+-/
+@[extern "bio_write_many"]
+opaque BIO.writeMany : @& BIO -> @& Array ByteArray -> (offset : USize) -> BaseIO (BIO.Status USize)
+
+@[extern "bio_flush_status"]
+opaque BIO.flushStatus : @& BIO -> BaseIO (BIO.Status Unit)
+
+@[extern "bio_handshake_status"]
+opaque BIO.handshakeStatus : @& BIO -> BaseIO (BIO.Status Unit)
+
+/--
+A TLS connection without I/O: the SSL side sits on one half of an in-memory BIO pair,
+and the caller moves ciphertext through the other half with `feed`, `drain` and `pump`.
+The engine owns both halves, so there is nothing to keep alive separately.
+-/
+@[extern "engine_new"]
+opaque Engine.new : @& SSLContext -> (client : Bool) -> IO Engine
+
+/--
+The SSL BIO of the engine, for configuration (`set_sni`, `set_session_cache`, ...) and inspection.
+Reading and writing through it only ever reports would-block for the transport, `Engine.pump` does the I/O.
+-/
+@[extern "engine_bio"]
+opaque Engine.bio : @& Engine -> BaseIO BIO
+
+/-- Hand over received ciphertext from `offset` on. Returns how many bytes were taken before the engine's buffer filled. -/
+@[extern "engine_feed"]
+opaque Engine.feed : @& Engine -> @& ByteArray -> (offset : USize) -> BaseIO USize
+
+/-- Append at most `max` bytes of ciphertext to send to `buf`, in place when `buf` is uniquely referenced. -/
+@[extern "engine_drain"]
+opaque Engine.drain : @& Engine -> (buf : ByteArray) -> (max : USize) -> BaseIO ByteArray
+
+/-- Outcome of `Engine.pump`. -/
+structure Engine.Pump where
+  /-- The `plaintext` buffer with the received plaintext appended. -/
+  plaintext : ByteArray
+  /-- The `ciphertext` buffer with the ciphertext to send appended. -/
+  ciphertext : ByteArray
+  /--
+  `ok` once the handshake is done and `wantRead` before, unless the connection failed or was closed by the peer.
+  -/
+  status : BIO.Status Unit
+  /-- Bytes of the received ciphertext taken. -/
+  fed : USize
+  /-- Bytes of the plaintext to send taken. -/
+  written : USize
+
+/--
+One step of the engine in a single call: take the received ciphertext `input`, drive the handshake,
+encrypt `output` and decrypt whatever arrived, draining ciphertext in between, until nothing moves any more.
+Decrypted plaintext is appended to `plaintext` and ciphertext to send to `ciphertext`,
+both in place when uniquely referenced. Plaintext is only taken once the handshake is done.
+-/
+@[extern "engine_pump"]
+opaque Engine.pump : @& Engine -> (input output : @& ByteArray) -> (plaintext ciphertext : ByteArray) ->
+  BaseIO Engine.Pump
+
+/--
+Configure the crypto worker pool: `workers` threads, at most `capacity` queued steps,
+and writes of at least `writeThreshold` bytes are encrypted on the pool too.
+With workers, `BIO.handshakeAsync` and large `BIO.writeAsync` calls run on the pool
+instead of the task thread that resumes them. `workers := 0` disables the pool again:
+queued steps still finish, then the workers exit. So does `capacity := 0`, the pool needs room for one step.
+-/
+@[extern "crypto_pool_configure"]
+opaque CryptoPool.configure (workers capacity writeThreshold : USize) : BaseIO Unit
+
+@[extern "crypto_pool_enabled"]
+opaque CryptoPool.enabled : BaseIO Bool
+
+/-- `USize.size - 1` while the pool is disabled. -/
+@[extern "crypto_pool_write_threshold"]
+opaque CryptoPool.write_threshold : BaseIO USize
+
+/-- Steps waiting for a worker. -/
+@[extern "crypto_pool_queued"]
+opaque CryptoPool.queued : BaseIO USize
+
+/--
+Run `wake` once a queue slot is reserved for the caller, in the order the callers found the queue full,
+or once the pool is disabled. Returns `false`, and never runs `wake`, if a submit can be retried right away.
+The reserved slot is taken by the next submit with `reserved := true`.
+-/
+@[extern "crypto_pool_await_slot"]
+opaque CryptoPool.await_slot (wake : BaseIO Unit) : BaseIO Bool
+
+/--
+Run one handshake step on the crypto pool, then `done`. Returns `false` if the queue is full.
+`reserved` uses the slot reserved by `CryptoPool.await_slot`.
+-/
+@[extern "bio_handshake_offload"]
+opaque BIO.handshake_offload : @& BIO -> (reserved : Bool) -> (done : BIO.Status Unit → BaseIO Unit) -> BaseIO Bool
+
+/-- Like `BIO.writeStatus`, on the crypto pool. Returns `false` if the queue is full, see `BIO.handshake_offload`. -/
+@[extern "bio_write_offload"]
+opaque BIO.write_offload : @& BIO -> ByteArray -> (reserved : Bool) -> (done : BIO.Status USize → BaseIO Unit) ->
+  BaseIO Bool
+
 @[extern "bio_should_retry"]
 opaque BIO.shouldRetry : @& BIO -> BaseIO Bool
 
@@ -85,9 +311,335 @@ opaque SSLContext.load_verify_file : @& SSLContext -> String -> IO Unit
 @[extern "ssl_ctx_set_default_verify_paths"]
 opaque SSLContext.set_default_verify_paths : @& SSLContext -> IO Unit
 
+/-- Trusted CA certificates from a PEM bundle, parsed once here. -/
+@[extern "x509_trust_store_load_file"]
+opaque TrustStore.loadFile : @& String -> IO TrustStore
+
+/--
+Trusted CA certificates in a hashed directory (see `openssl rehash`).
+Nothing is read here, a certificate is loaded the first time a chain needs it.
+-/
+@[extern "x509_trust_store_load_dir"]
+opaque TrustStore.loadDir : @& String -> IO TrustStore
+
+/-- OpenSSL's default bundle file and hashed directory, which `SSL_CERT_FILE` and `SSL_CERT_DIR` override. -/
+@[extern "x509_trust_store_system"]
+opaque TrustStore.system : IO TrustStore
+
+/--
+Verify peers against `store` instead of the context's own.
+A store is shared, not copied, so any number of contexts can use one.
+-/
+@[extern "ssl_ctx_set_trust_store"]
+opaque SSLContext.set_trust_store : @& SSLContext -> @& TrustStore -> BaseIO Unit
+
+@[extern "ssl_ctx_set_cipher_list"]
+opaque SSLContext.set_cipher_list : @& SSLContext -> String -> IO Unit
+
+@[extern "ssl_ctx_set_ciphersuites"]
+opaque SSLContext.set_ciphersuites : @& SSLContext -> String -> IO Unit
+
+/-- Signature algorithms to offer and accept, in OpenSSL's list syntax, e.g. `ECDSA+SHA256:rsa_pss_rsae_sha256`. -/
+@[extern "ssl_ctx_set_sigalgs"]
+opaque SSLContext.set_sigalgs : @& SSLContext -> String -> IO Unit
+
+/-- Key exchange groups in order of preference, e.g. `X25519:P-256`. A client sends a key share for the first. -/
+@[extern "ssl_ctx_set_groups"]
+opaque SSLContext.set_groups : @& SSLContext -> String -> IO Unit
+
+/-- Bound the protocol version by wire versions, e.g. `0x0304` for TLS 1.3. `0` leaves that bound open. -/
+@[extern "ssl_ctx_set_proto_versions"]
+opaque SSLContext.set_proto_versions : @& SSLContext -> (min max : UInt16) -> IO Unit
+
+/--
+Server side: pick the cipher by the server's order instead of the client's.
+With `prioritizeChaCha`, clients listing ChaCha20-Poly1305 first still get it.
+-/
+@[extern "ssl_ctx_set_server_cipher_preference"]
+opaque SSLContext.set_server_cipher_preference : @& SSLContext -> (prioritizeChaCha : Bool) -> BaseIO Unit
+
+/-- Whether the CPU accelerates AES-GCM (AES-NI or VAES with PCLMULQDQ, or the ARMv8 crypto extension). -/
+@[extern "crypto_has_aes_hardware"]
+opaque has_aes_hardware : BaseIO Bool
+
+/-!
+Hashing, HMAC and AEAD with OpenSSL's implementations, fed one chunk at a time.
+Algorithms are named as in OpenSSL, e.g. `SHA256`, `SHA512`, `BLAKE2b512`, `AES-128-GCM` or `ChaCha20-Poly1305`.
+Each object is a mutable state, so it must not be used from several tasks at once.
+-/
+
+@[extern "crypto_digest_new"]
+opaque Digest.new : (algorithm : @& String) -> IO Digest
+
+@[extern "crypto_digest_update"]
+opaque Digest.update : @& Digest -> @& ByteArray -> IO Unit
+
+/-- The digest of everything since `new` or the previous `final`. The digest then starts over. -/
+@[extern "crypto_digest_final"]
+opaque Digest.final : @& Digest -> IO ByteArray
+
+/-- A copy of the current state, e.g. to finish a common prefix with different suffixes. -/
+@[extern "crypto_digest_copy"]
+opaque Digest.copy : @& Digest -> IO Digest
+
+/-- The digest of each input, all in a single call. -/
+@[extern "crypto_hash_many"]
+opaque hash_many : (algorithm : @& String) -> @& Array ByteArray -> IO (Array ByteArray)
+
+/-- HMAC with the digest `algorithm`. -/
+@[extern "crypto_hmac_new"]
+opaque Mac.hmac : (algorithm : @& String) -> (key : @& ByteArray) -> IO Mac
+
+@[extern "crypto_mac_update"]
+opaque Mac.update : @& Mac -> @& ByteArray -> IO Unit
+
+/-- The MAC of everything since `hmac` or the previous `final`. It then starts over with the same key. -/
+@[extern "crypto_mac_final"]
+opaque Mac.final : @& Mac -> IO ByteArray
+
+/-- Compare in time independent of the contents, for MACs and tags. -/
+@[extern "crypto_constant_time_eq"]
+opaque constant_time_eq : @& ByteArray -> @& ByteArray -> Bool
+
+/--
+An AEAD that encrypts or decrypts (`encrypt := false`) many messages under one key.
+Only AES-GCM and ChaCha20-Poly1305 can be streamed, other AEADs such as CCM and OCB are refused.
+-/
+@[extern "crypto_aead_new"]
+opaque Aead.new : (algorithm : @& String) -> (key : @& ByteArray) -> (encrypt : Bool) -> IO Aead
+
+/-- Begin a message. A nonce must never be used twice with the same key. -/
+@[extern "crypto_aead_start"]
+opaque Aead.start : @& Aead -> (nonce : @& ByteArray) -> IO Unit
+
+/-- Authenticate, but do not encrypt, `aad`. All of it has to come before the first `update`. -/
+@[extern "crypto_aead_aad"]
+opaque Aead.aad : @& Aead -> (aad : @& ByteArray) -> IO Unit
+
+/-- Encrypt or decrypt `input`, appending the result to `buf`. -/
+@[extern "crypto_aead_update"]
+opaque Aead.update : @& Aead -> (input : @& ByteArray) -> (buf : ByteArray) -> IO ByteArray
+
+/-- End the message being encrypted and return its 16 byte authentication tag. -/
+@[extern "crypto_aead_seal_final"]
+opaque Aead.seal_final : @& Aead -> IO ByteArray
+
+/--
+End the message being decrypted and check its tag. Tags other than 16 bytes long are rejected.
+The plaintext from `update` must be discarded unless this returns `true`.
+-/
+@[extern "crypto_aead_open_final"]
+opaque Aead.open_final : @& Aead -> (tag : @& ByteArray) -> IO Bool
+
 @[extern "ssl_ctx_set_alpn_wire"]
 opaque SSLContext.set_alpn_wire : @& SSLContext -> @& ByteArray -> IO Unit
 
+/--
+Use a freshly generated P-256 key and a self-signed certificate for `commonName`, valid for one day.
+Meant for tests and benchmarks.
+-/
+@[extern "ssl_ctx_use_self_signed"]
+opaque SSLContext.use_self_signed : @& SSLContext -> @& String -> IO Unit
+
+/-- OpenSSL heap usage, counted only after `enable_alloc_stats` succeeded. -/
+structure AllocStats where
+  /-- Number of `malloc`/`realloc` calls. -/
+  count : UInt64
+  /-- Total bytes requested. -/
+  bytes : UInt64
+  /-- Bytes currently allocated. -/
+  liveBytes : UInt64
+  deriving Repr, Inhabited
+
+/--
+Route OpenSSL's allocations through counting wrappers.
+This only succeeds before OpenSSL's first allocation, so call it first thing in `main`.
+-/
+@[extern "crypto_enable_alloc_stats"]
+opaque enable_alloc_stats : BaseIO Bool
+
+@[extern "crypto_alloc_stats"]
+opaque alloc_stats : BaseIO AllocStats
+
+/-- Server side: select from this ALPN wire list, in order of preference. -/
+@[extern "ssl_ctx_set_alpn_select_wire"]
+opaque SSLContext.set_alpn_select_wire : @& SSLContext -> @& ByteArray -> IO Unit
+
+/-- PEM file with the leaf certificate followed by its intermediates. -/
+@[extern "ssl_ctx_use_certificate_chain_file"]
+opaque SSLContext.use_certificate_chain_file : @& SSLContext -> @& String -> IO Unit
+
+/-- PEM private key, checked against the certificate, so load that first. -/
+@[extern "ssl_ctx_use_private_key_file"]
+opaque SSLContext.use_private_key_file : @& SSLContext -> @& String -> IO Unit
+
+/--
+Server side: switch connections whose SNI is `name` to `sniCtx`.
+Lookup is a hash map probe, names are case-insensitive and `*.example.com` matches one label.
+Unknown names stay on this context.
+-/
+@[extern "ssl_ctx_add_sni_context"]
+opaque SSLContext.add_sni_context : @& SSLContext -> @& String -> @& SSLContext -> IO Unit
+
+/-- Session ticket keys, shareable between server contexts. Created with a fresh current key. -/
+@[extern "ssl_ticket_keys_new"]
+opaque TicketKeys.new : IO TicketKeys
+
+/-- Issue tickets under a fresh key. Tickets under the previous key are still accepted and renewed. -/
+@[extern "ssl_ticket_keys_rotate"]
+opaque TicketKeys.rotate : @& TicketKeys -> IO Unit
+
+/--
+Encrypt session tickets with `keys`, so a ticket issued by any context sharing them resumes on this one.
+Also turns off the server-side session cache: resumption becomes stateless,
+and so does replay protection of early data, see `set_max_early_data`.
+-/
+@[extern "ssl_ctx_set_ticket_keys"]
+opaque SSLContext.set_ticket_keys : @& SSLContext -> @& TicketKeys -> IO Unit
+
+/-- `ctx.share_certificate src` uses the certificate, chain and key of `src`, without loading them again. -/
+@[extern "ssl_ctx_share_certificate"]
+opaque SSLContext.share_certificate : @& SSLContext -> @& SSLContext -> IO Unit
+
+/--
+Let the kernel do record encryption once the handshake is done (kTLS), set before the handshake.
+Only a native socket transport qualifies. Without kernel or cipher support OpenSSL stays in user space,
+see `BIO.ktls_send` and `BIO.ktls_recv` for what was actually used.
+-/
+@[extern "bio_enable_ktls"]
+opaque BIO.enable_ktls : @& BIO -> IO Unit
+
+@[extern "bio_ktls_send"]
+opaque BIO.ktls_send : @& BIO -> BaseIO Bool
+
+@[extern "bio_ktls_recv"]
+opaque BIO.ktls_recv : @& BIO -> BaseIO Bool
+
+/-- Read at most `max` bytes of the file at `path` from `offset`. Empty at the end of the file. -/
+@[extern "file_read_range"]
+opaque readFileRange : @& String -> (offset : UInt64) -> (max : USize) -> IO ByteArray
+
+/-- Send at most `size` bytes of the file at `path` from `offset` with `SSL_sendfile`. Requires `ktls_send`. -/
+@[extern "bio_sendfile"]
+opaque BIO.sendfile : @& BIO -> @& String -> (offset : UInt64) -> (size : USize) -> BaseIO (BIO.Status USize)
+
+/--
+Low-memory mode for mostly idle connections: OpenSSL releases its record buffers whenever they are empty
+(`SSL_MODE_RELEASE_BUFFERS`), and the stream transport stops keeping a spare send buffer.
+Set on a context, it applies to every BIO made from it.
+-/
+@[extern "ssl_ctx_set_low_memory"]
+opaque SSLContext.set_low_memory : @& SSLContext -> Bool -> BaseIO Unit
+
+/-- See `SSLContext.set_low_memory`. Enabling it also frees the buffers that are idle right now. -/
+@[extern "bio_set_low_memory"]
+opaque BIO.set_low_memory : @& BIO -> Bool -> BaseIO Unit
+
+/-- Bytes held by the stream transport's send and receive buffers, `0` for other transports. -/
+@[extern "bio_buffer_bytes"]
+opaque BIO.buffer_bytes : @& BIO -> BaseIO USize
+
+/--
+The largest record plaintext sent, from 512 up to the default 16384 bytes.
+Smaller records can be decrypted as soon as they arrive, at the cost of more record overhead.
+-/
+@[extern "ssl_ctx_set_max_send_fragment"]
+opaque SSLContext.set_max_send_fragment : @& SSLContext -> USize -> IO Unit
+
+/--
+Lowering it works at any time, raising it only before the handshake,
+because the write buffer is sized for the value at that point.
+-/
+@[extern "bio_set_max_send_fragment"]
+opaque BIO.set_max_send_fragment : @& BIO -> USize -> IO Unit
+
+/--
+Read ahead into a buffer of `bufferLen` bytes, so one `recv` can bring in several records
+instead of each record header and body taking its own. `0` turns it off.
+-/
+@[extern "ssl_ctx_set_read_ahead"]
+opaque SSLContext.set_read_ahead : @& SSLContext -> (bufferLen : USize) -> BaseIO Unit
+
+/-- See `SSLContext.set_read_ahead`. The buffer size only applies if the read buffer is not allocated yet. -/
+@[extern "bio_set_read_ahead"]
+opaque BIO.set_read_ahead : @& BIO -> (bufferLen : USize) -> BaseIO Unit
+
+/--
+Encrypt up to `n` (at most 32) records of one write in parallel.
+Only cipher implementations with pipeline support make use of it, with the others it has no effect.
+Decrypting in parallel also needs read-ahead, see `SSLContext.set_read_ahead`.
+-/
+@[extern "ssl_ctx_set_max_pipelines"]
+opaque SSLContext.set_max_pipelines : @& SSLContext -> USize -> IO Unit
+
+@[extern "bio_set_max_pipelines"]
+opaque BIO.set_max_pipelines : @& BIO -> USize -> IO Unit
+
+/--
+Dynamic record sizing: writes go out as records of at most `smallRecord` bytes,
+so the first bytes of a response can be decrypted before the full 16 KB record arrived,
+until `threshold` bytes of application data were sent. Larger records follow from then on,
+and after `idleMs` milliseconds without a write it starts over with small records.
+`smallRecord` `0` turns it off. Set on a context, it applies to every BIO made from it afterwards.
+-/
+@[extern "ssl_ctx_set_dynamic_records"]
+opaque SSLContext.set_dynamic_records : @& SSLContext -> (smallRecord : USize) -> (threshold : UInt64) ->
+  (idleMs : UInt32) -> BaseIO Unit
+
+/-- See `SSLContext.set_dynamic_records`. -/
+@[extern "bio_set_dynamic_records"]
+opaque BIO.set_dynamic_records : @& BIO -> (smallRecord : USize) -> (threshold : UInt64) ->
+  (idleMs : UInt32) -> BaseIO Unit
+
+/--
+Whether a connection that should be idle can be reused: nothing unread, no `close_notify`, no error.
+Does not block, so it is cheap enough to run on every reuse.
+-/
+@[extern "bio_idle_check"]
+opaque BIO.idle_check : @& BIO -> BaseIO Bool
+
+/-- What became of TLS 1.3 early data (0-RTT) on a connection. -/
+inductive EarlyDataStatus where
+  | notSent
+  | rejected
+  | accepted
+  deriving BEq, Repr, Inhabited
+
+/--
+The most early data this client connection may send, `0` unless the session set by `set_session_cache`
+allows early data and the handshake has not started yet.
+-/
+@[extern "bio_early_data_limit"]
+opaque BIO.early_data_limit : @& BIO -> BaseIO UInt32
+
+/--
+Client side: send data before the handshake, with the first flight. Early data can be replayed by an attacker,
+and the server may reject it, see `early_data_status`. Prefer `Tls.connect` with `earlyData?`.
+-/
+@[extern "bio_write_early_data"]
+opaque BIO.write_early_data : @& BIO -> @& ByteArray -> BaseIO (BIO.Status USize)
+
+/-- Whether early data was sent and accepted. Final once the handshake is done. -/
+@[extern "bio_early_data_status"]
+opaque BIO.early_data_status : @& BIO -> BaseIO EarlyDataStatus
+
+/--
+Server side: accept up to `max` bytes of early data on resumed connections, `0` to refuse it.
+With the session cache, OpenSSL accepts early data once per ticket.
+With `set_ticket_keys` there is no cache to check tickets against, so its replay protection is turned off,
+and the application must only act on early data that is safe to replay.
+-/
+@[extern "ssl_ctx_set_max_early_data"]
+opaque SSLContext.set_max_early_data : @& SSLContext -> UInt32 -> BaseIO Unit
+
+/-- Server side: read early data before the handshake. `closed` once there is none left. -/
+@[extern "bio_read_early_data"]
+opaque BIO.read_early_data : @& BIO -> USize -> BaseIO (BIO.Status ByteArray)
+
+/-- The SNI sent by the client, or set by `set_sni`. -/
+@[extern "bio_server_name"]
+opaque BIO.server_name : @& BIO -> BaseIO (Option String)
+
 @[extern "bio_handshake"]
 opaque BIO.handshake : @& BIO -> IO Unit
 
@@ -100,6 +652,83 @@ opaque BIO.set_sni : @& BIO -> String -> IO Unit
 @[extern "bio_get_alpn_selected"]
 opaque BIO.get_alpn_selected : @& BIO -> BaseIO (Option ByteArray)
 
+/--
+A client session cache holding at most `capacity` sessions, keyed by an arbitrary string
+(usually host, port and SNI). Thread-safe, may be shared by any number of contexts.
+-/
+@[extern "ssl_session_cache_new"]
+opaque SessionCache.new (capacity : USize) : IO SessionCache
+
+@[extern "ssl_session_cache_size"]
+opaque SessionCache.size : @& SessionCache -> BaseIO USize
+
+/-- Make the context hand new sessions (TLS 1.2 session IDs and TLS 1.3 tickets) to the connection's `SessionCache`. -/
+@[extern "ssl_ctx_enable_client_session_cache"]
+opaque SSLContext.enable_client_session_cache : @& SSLContext -> BaseIO Unit
+
+/--
+Attach `cache` to the SSL object in the chain. Must be called before the handshake.
+A session cached under `key` is offered for resumption, and new sessions are stored under `key`.
+-/
+@[extern "bio_set_session_cache"]
+opaque BIO.set_session_cache : @& BIO -> @& SessionCache -> @& String -> IO Unit
+
+/-- Whether the handshake resumed a cached session. -/
+@[extern "bio_session_reused"]
+opaque BIO.session_reused : @& BIO -> BaseIO Bool
+
+/--
+TLS counters, kept per connection and summed up process-wide.
+* Handshake time is split into time spent inside OpenSSL (`handshakeCpuNs`)
+  and time spent waiting for the peer between calls (`handshakeWaitNs`).
+* Records and bytes are counted on the wire, including record headers.
+* Retries count every would-block reported to Lean, task polls every poll of a pending `Stream` task.
+* `bufferBytesAllocated` is the capacity of every `ByteArray` the shim allocates for reads and send batches.
+-/
+structure Metrics where
+  handshakes : UInt64
+  handshakesResumed : UInt64
+  handshakeCpuNs : UInt64
+  handshakeWaitNs : UInt64
+  recordsSent : UInt64
+  recordsReceived : UInt64
+  bytesSent : UInt64
+  bytesReceived : UInt64
+  retryRead : UInt64
+  retryWrite : UInt64
+  retryIOSpecial : UInt64
+  taskPolls : UInt64
+  taskPollsPending : UInt64
+  bufferBytesAllocated : UInt64
+  deriving Repr, Inhabited
+
+def Metrics.resumptionRate (m : Metrics) : Float :=
+  if m.handshakes == 0 then 0 else m.handshakesResumed.toFloat / m.handshakes.toFloat
+
+/-- Counters of all connections since the process started. -/
+@[extern "tls_global_metrics"]
+opaque global_metrics : BaseIO Metrics
+
+/-- Counters of the SSL object and the stream transport in this chain. -/
+@[extern "bio_metrics"]
+opaque BIO.metrics : @& BIO -> BaseIO Metrics
+
+/-- Completed handshakes by duration: bucket `i` counts durations in `[2^(i-1), 2^i)` microseconds. -/
+@[extern "tls_handshake_histogram"]
+opaque handshake_histogram : BaseIO (Array UInt64)
+
+/-- The negotiated cipher, e.g. `TLS_AES_128_GCM_SHA256`. -/
+@[extern "bio_cipher_name"]
+opaque BIO.cipher_name : @& BIO -> BaseIO (Option String)
+
+/-- The negotiated key exchange group, e.g. `x25519`, once the handshake finished. -/
+@[extern "bio_group_name"]
+opaque BIO.group_name : @& BIO -> BaseIO (Option String)
+
+/-- The negotiated protocol version, e.g. `TLSv1.3`, once the handshake finished. -/
+@[extern "bio_protocol_version"]
+opaque BIO.protocol_version : @& BIO -> BaseIO (Option String)
+
 def SSL_VERIFY_NONE                 : Int32 := 0x00
 def SSL_VERIFY_PEER                 : Int32 := 0x01
 def SSL_VERIFY_FAIL_IF_NO_PEER_CERT : Int32 := 0x02
@@ -140,6 +769,10 @@ def SSLContext.set_alpn_protocols (ctx : SSLContext) (protocols : Array String)
   let wire ← encodeALPNWire protocols
   ctx.set_alpn_wire wire
 
+def SSLContext.set_alpn_select_protocols (ctx : SSLContext) (protocols : Array String) : IO Unit := do
+  let wire ← encodeALPNWire protocols
+  ctx.set_alpn_select_wire wire
+
 def BIO.negotiatedALPN? (bio : BIO) : BaseIO (Option String) := do
   match (← bio.get_alpn_selected) with
   | none => return none
@@ -149,32 +782,253 @@ end
 
 section
 
+private def discardResult (t : Task (Except IO.Error α)) : Task (Except IO.Error Unit) :=
+  t.map (sync := true) fun _ => .ok ()
+
+/--
+The transport task that blocks progress of `bio` in the given direction, if any.
+Writes can also be blocked by a pending flush.
+-/
+def BIO.pendingTask? (bio : BIO) (write : Bool) : BaseIO (Option (Task (Except IO.Error Unit))) := do
+  if write then
+    match ← bio.pending_send_task with
+    | some t => return some (discardResult t)
+    | none => return (← bio.pending_flush_task).map discardResult
+  else
+    return (← bio.pending_recv_task).map discardResult
+
+/-- Wait for readiness of the socket in the chain. Returns `false` if there is none. -/
+def BIO.awaitSocket (bio : BIO) (write : Bool) : Async Bool := do
+  let promise ← IO.Promise.new (α := Except IO.Error Unit)
+  if ← bio.socket_wait write (promise.resolve (.ok ())) then
+    discard <| Async.ofTask promise.result!
+    return true
+  return false
+
+/--
+Wait until `bio` can make progress after a retry error.
+Stream BIOs are waited on through their pending task and socket BIOs through their readiness.
+Other chains (e.g. memory BIOs) have nothing to wait on and back off for 1 ms instead.
+-/
+def BIO.awaitRetry (bio : BIO) (write : Bool) : Async Unit := do
+  match ← bio.pendingTask? write with
+  | some t => discard <| Async.ofTask t
+  | none =>
+    unless ← bio.awaitSocket write do
+      sleep 1
+
+/-- Connect a native socket BIO, see `BIO.socket_connect`. -/
+def BIO.connectSocketAsync (host : String) (port : UInt16) : Async BIO := do
+  let bio ← BIO.socket_connect host port
+  discard <| bio.awaitSocket (write := true)
+  bio.socket_finish_connect
+  return bio
+
+/-- Connect an io_uring socket BIO, see `BIO.uring_connect`. -/
+def BIO.connectUringAsync (host : String) (port : UInt16) : Async BIO := do
+  let bio ← BIO.uring_connect host port
+  discard <| bio.awaitSocket (write := true)
+  bio.socket_finish_connect
+  return bio
+
+/--
+Submit a step to the crypto pool and wait for its outcome.
+While the queue is full, wait for a slot to be reserved, see `CryptoPool.await_slot`.
+If the pool is disabled meanwhile, the step runs `inline` instead.
+-/
+partial def CryptoPool.run (submit : (reserved : Bool) → (BIO.Status α → BaseIO Unit) → BaseIO Bool)
+    (inline : BaseIO (BIO.Status α)) (reserved : Bool := false) : Async (BIO.Status α) := do
+  let result ← IO.mkRef (none : Option (BIO.Status α))
+  let promise ← IO.Promise.new (α := Except IO.Error Unit)
+  let done (st : BIO.Status α) : BaseIO Unit := do
+    result.set (some st)
+    promise.resolve (.ok ())
+  if ← submit reserved done then
+    discard <| Async.ofTask promise.result!
+    match ← result.get with
+    | some st => return st
+    | none => throw <| IO.userError "CryptoPool.run: step finished without a result"
+  else if !(← CryptoPool.enabled) then
+    inline
+  else
+    let slot ← IO.Promise.new (α := Except IO.Error Unit)
+    let waiting ← CryptoPool.await_slot (slot.resolve (.ok ()))
+    if waiting then
+      discard <| Async.ofTask slot.result!
+    CryptoPool.run submit inline (reserved := waiting)
+
 partial def BIO.writeAsync (bio : BIO) (data : ByteArray) : Async Unit := do
-  try
-    bio.write data
-  catch
-  | ERR_RETRY_WRITE =>
-    sleep 1
+  let status ←
+    if data.size ≥ (← CryptoPool.write_threshold).toNat then
+      CryptoPool.run (bio.write_offload data) (bio.writeStatus data)
+    else
+      bio.writeStatus data
+  match status with
+  | .ok n =>
+    if n.toNat < data.size then
+      BIO.writeAsync bio (data.extract n.toNat data.size)
+  | .wantWrite =>
+    bio.awaitRetry (write := true)
     BIO.writeAsync bio data
-  | err => throw err
+  | .wantRead =>
+    bio.awaitRetry (write := false)
+    BIO.writeAsync bio data
+  | .wantIOSpecial => throw ERR_RETRY_IO_SPECIAL
+  | .closed => throw <| IO.userError "BIO.writeAsync: connection closed"
+  | .error err => throw err
+
+/-- Push everything written so far down the chain. Stream BIOs only send gathered bytes on flush. -/
+partial def BIO.flushAsync (bio : BIO) : Async Unit := do
+  match ← bio.flushStatus with
+  | .ok () => pure ()
+  | .wantWrite =>
+    bio.awaitRetry (write := true)
+    BIO.flushAsync bio
+  | .wantRead =>
+    bio.awaitRetry (write := false)
+    BIO.flushAsync bio
+  | .wantIOSpecial => throw ERR_RETRY_IO_SPECIAL
+  | .closed => throw <| IO.userError "BIO.flushAsync: connection closed"
+  | .error err => throw err
+
+private partial def BIO.writeManyFrom (bio : BIO) (parts : Array ByteArray) (total offset : Nat) : Async Unit := do
+  if offset ≥ total then
+    return
+  match ← bio.writeMany parts (USize.ofNat offset) with
+  | .ok n => BIO.writeManyFrom bio parts total (offset + n.toNat)
+  | .wantWrite =>
+    bio.awaitRetry (write := true)
+    BIO.writeManyFrom bio parts total offset
+  | .wantRead =>
+    bio.awaitRetry (write := false)
+    BIO.writeManyFrom bio parts total offset
+  | .wantIOSpecial => throw ERR_RETRY_IO_SPECIAL
+  | .closed => throw <| IO.userError "BIO.writeManyAsync: connection closed"
+  | .error err => throw err
+
+/-- Write all of `parts` (e.g. headers followed by body slices) as full-size records, then flush once. -/
+def BIO.writeManyAsync (bio : BIO) (parts : Array ByteArray) : Async Unit := do
+  let total := parts.foldl (init := 0) fun acc part => acc + part.size
+  bio.writeManyFrom parts total 0
+  bio.flushAsync
 
+/-- Returns `none` once the peer closed the connection (cleanly or not). -/
 partial def BIO.readAsync? (bio : BIO) (max : USize) : Async (Option ByteArray) := do
-  try
-    some <$> bio.read max
-  catch
-  | ERR_RETRY_READ =>
-    sleep 1
+  match ← bio.readStatus max with
+  | .ok data => return some data
+  | .wantRead =>
+    bio.awaitRetry (write := false)
     BIO.readAsync? bio max
-  | err@(ERR_RETRY _) => throw err
-  | _ => return none
+  | .wantWrite =>
+    bio.awaitRetry (write := true)
+    BIO.readAsync? bio max
+  | .wantIOSpecial => throw ERR_RETRY_IO_SPECIAL
+  | .closed | .error _ => return none
+
+/-- Like `BIO.readAsync?`, but drains all buffered data at once, see `BIO.readAvailable`. -/
+partial def BIO.readAvailableAsync? (bio : BIO) (max : USize) : Async (Option ByteArray) := do
+  match ← bio.readAvailable max with
+  | .ok data => return some data
+  | .wantRead =>
+    bio.awaitRetry (write := false)
+    BIO.readAvailableAsync? bio max
+  | .wantWrite =>
+    bio.awaitRetry (write := true)
+    BIO.readAvailableAsync? bio max
+  | .wantIOSpecial => throw ERR_RETRY_IO_SPECIAL
+  | .closed | .error _ => return none
+
+/--
+Like `BIO.readAsync?`, but appends to `buf`, see `BIO.readInto`.
+Returns the buffer together with the number of bytes appended, or `none` once the peer closed the connection.
+-/
+partial def BIO.readIntoAsync? (bio : BIO) (buf : ByteArray) (max : USize) : Async (ByteArray × Option USize) := do
+  let (buf, status) ← bio.readInto buf max
+  match status with
+  | .ok n => return (buf, some n)
+  | .wantRead =>
+    bio.awaitRetry (write := false)
+    BIO.readIntoAsync? bio buf max
+  | .wantWrite =>
+    bio.awaitRetry (write := true)
+    BIO.readIntoAsync? bio buf max
+  | .wantIOSpecial => throw ERR_RETRY_IO_SPECIAL
+  | .closed | .error _ => return (buf, none)
+
+/-- Bytes read per step when `BIO.sendfileAsync` cannot use kTLS. -/
+def sendfileChunk : Nat := 256 * 1024
 
+/--
+Send `size` bytes of the file at `path` from `offset`.
+With kTLS the kernel reads and encrypts the file.
+Otherwise only the range is read, `sendfileChunk` bytes at a time, and written.
+-/
+partial def BIO.sendfileAsync (bio : BIO) (path : String) (offset size : Nat) : Async Unit := do
+  if size == 0 then
+    return
+  unless ← bio.ktls_send do
+    let chunk ← readFileRange path (UInt64.ofNat offset) (USize.ofNat (min size sendfileChunk))
+    if chunk.isEmpty then
+      throw <| IO.userError s!"BIO.sendfileAsync: {path} ends before offset {offset}"
+    bio.writeAsync chunk
+    BIO.sendfileAsync bio path (offset + chunk.size) (size - chunk.size)
+    return
+  match ← bio.sendfile path (UInt64.ofNat offset) (USize.ofNat size) with
+  | .ok n =>
+    if n == 0 then
+      throw <| IO.userError s!"BIO.sendfileAsync: {path} ends before offset {offset}"
+    BIO.sendfileAsync bio path (offset + n.toNat) (size - n.toNat)
+  | .wantWrite =>
+    bio.awaitRetry (write := true)
+    BIO.sendfileAsync bio path offset size
+  | .wantRead =>
+    bio.awaitRetry (write := false)
+    BIO.sendfileAsync bio path offset size
+  | .wantIOSpecial => throw ERR_RETRY_IO_SPECIAL
+  | .closed => throw <| IO.userError "BIO.sendfileAsync: connection closed"
+  | .error err => throw err
+
+/-- Write all of `data` as early data, before `handshakeAsync`. -/
+partial def BIO.writeEarlyDataAsync (bio : BIO) (data : ByteArray) : Async Unit := do
+  match ← bio.write_early_data data with
+  | .ok n =>
+    if n.toNat < data.size then
+      BIO.writeEarlyDataAsync bio (data.extract n.toNat data.size)
+  | .wantWrite =>
+    bio.awaitRetry (write := true)
+    BIO.writeEarlyDataAsync bio data
+  | .wantRead =>
+    bio.awaitRetry (write := false)
+    BIO.writeEarlyDataAsync bio data
+  | .wantIOSpecial => throw ERR_RETRY_IO_SPECIAL
+  | .closed => throw <| IO.userError "BIO.writeEarlyDataAsync: connection closed"
+  | .error err => throw err
+
+/-- Read all early data the client sent, before `handshakeAsync`. Empty if there is none. -/
+partial def BIO.readEarlyDataAsync (bio : BIO) (acc : ByteArray := .empty) : Async ByteArray := do
+  match ← bio.read_early_data (16 * 1024) with
+  | .ok bs => BIO.readEarlyDataAsync bio (acc ++ bs)
+  | .closed => return acc
+  | .wantWrite =>
+    bio.awaitRetry (write := true)
+    BIO.readEarlyDataAsync bio acc
+  | .wantRead | .wantIOSpecial =>
+    bio.awaitRetry (write := false)
+    BIO.readEarlyDataAsync bio acc
+  | .error err => throw err
+
+/-- Runs the handshake steps on the crypto pool when it has workers, see `CryptoPool.configure`. -/
 partial def BIO.handshakeAsync (bio : BIO) : Async Unit := do
-  try
-    bio.handshake
-  catch
-  | ERR_RETRY _ =>
-    sleep 1
+  let status ← if ← CryptoPool.enabled then CryptoPool.run bio.handshake_offload bio.handshakeStatus else bio.handshakeStatus
+  match status with
+  | .ok () => pure ()
+  | .wantWrite =>
+    bio.awaitRetry (write := true)
+    BIO.handshakeAsync bio
+  | .wantRead | .wantIOSpecial =>
+    bio.awaitRetry (write := false)
     BIO.handshakeAsync bio
-  | err => throw err
+  | .closed => throw <| IO.userError "BIO.handshakeAsync: connection closed during handshake"
+  | .error err => throw err
 
 end
@@ -1,15 +1,194 @@
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include <openssl/x509.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/core_names.h>
+#include <openssl/params.h>
 #include <lean/lean.h>
 #include <string>
+#include <memory>
 #include <vector>
-#include <functional>
 #include <optional>
+#include <mutex>
+#include <shared_mutex>
+#include <list>
+#include <unordered_map>
+#include <algorithm>
+#include <cctype>
+#include <thread>
+#include <deque>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <poll.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
 #include "FFI.shim.h"
 
+// Client-side session cache, keyed by host/port/SNI, evicting least recently stored sessions.
+// Shared between the Lean object and every connection that stores into it, hence `shared_ptr`.
+class SessionCache
+{
+private:
+  std::mutex m_mutex;
+  size_t m_capacity;
+  std::list<std::pair<std::string, SSL_SESSION *>> m_lru; // front is the most recently stored
+  std::unordered_map<std::string, std::list<std::pair<std::string, SSL_SESSION *>>::iterator> m_index;
+
+  void erase(const std::string & key)
+  {
+    auto it = m_index.find(key);
+    if (it == m_index.end())
+      return;
+    SSL_SESSION_free(it->second->second);
+    m_lru.erase(it->second);
+    m_index.erase(it);
+  }
+
+public:
+  explicit SessionCache(size_t capacity) : m_capacity(capacity) {}
+  SessionCache(const SessionCache &) = delete;
+  ~SessionCache()
+  {
+    for (auto & entry : m_lru)
+      SSL_SESSION_free(entry.second);
+  }
+
+  // Takes ownership of `sess`.
+  void put(const std::string & key, SSL_SESSION * sess)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    erase(key);
+    if (m_capacity == 0) {
+      SSL_SESSION_free(sess);
+      return;
+    }
+    m_lru.emplace_front(key, sess);
+    m_index[key] = m_lru.begin();
+    while (m_lru.size() > m_capacity)
+      erase(m_lru.back().first);
+  }
+
+  // Returns an owned reference, or `nullptr` on miss.
+  // TLS 1.3 tickets are single-use and are removed; TLS 1.2 sessions stay cached.
+  SSL_SESSION * take(const std::string & key)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_index.find(key);
+    if (it == m_index.end())
+      return nullptr;
+    SSL_SESSION * sess = it->second->second;
+    if (SSL_SESSION_get_protocol_version(sess) >= TLS1_3_VERSION) {
+      m_lru.erase(it->second);
+      m_index.erase(it);
+      return sess;
+    }
+    SSL_SESSION_up_ref(sess);
+    return sess;
+  }
+
+  size_t size()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_lru.size();
+  }
+};
+
+// Session ticket keys shared by server contexts, so a ticket issued by one context decrypts on any other.
+// After `rotate`, tickets under the previous key are still accepted, and renewed.
+class TicketKeys
+{
+public:
+  struct Key
+  {
+    unsigned char name[16];
+    unsigned char aes[32];
+    unsigned char hmac[32];
+  };
+
+  enum Found { NOT_FOUND = 0, CURRENT = 1, PREVIOUS = 2 };
+
+private:
+  std::shared_mutex m_mutex;
+  Key m_current;
+  Key m_previous;
+  // Keys start out zeroed: a missing key must never match a ticket named with zeros.
+  bool m_has_current = false;
+  bool m_has_previous = false;
+
+public:
+  TicketKeys(const TicketKeys &) = delete;
+  TicketKeys() = default;
+  ~TicketKeys()
+  {
+    OPENSSL_cleanse(&m_current, sizeof(Key));
+    OPENSSL_cleanse(&m_previous, sizeof(Key));
+  }
+
+  // The first call creates the current key.
+  bool rotate()
+  {
+    Key fresh;
+    if (RAND_bytes((unsigned char *)&fresh, sizeof(Key)) != 1)
+      return false;
+    std::unique_lock lock(m_mutex);
+    m_previous = m_current;
+    m_has_previous = m_has_current;
+    m_current = fresh;
+    m_has_current = true;
+    OPENSSL_cleanse(&fresh, sizeof(Key));
+    return true;
+  }
+
+  void current(Key & out)
+  {
+    std::shared_lock lock(m_mutex);
+    out = m_current;
+  }
+
+  Found find(const unsigned char * name, Key & out)
+  {
+    std::shared_lock lock(m_mutex);
+    if (m_has_current && memcmp(name, m_current.name, sizeof(m_current.name)) == 0) {
+      out = m_current;
+      return CURRENT;
+    }
+    if (m_has_previous && memcmp(name, m_previous.name, sizeof(m_previous.name)) == 0) {
+      out = m_previous;
+      return PREVIOUS;
+    }
+    return NOT_FOUND;
+  }
+};
+
 SIMPLE_EXTERNAL_CLASS(ssl_method, const SSL_METHOD *);
 SIMPLE_EXTERNAL_CLASS(ssl_ctx, SSL_CTX *);
 SIMPLE_EXTERNAL_CLASS(bio, BIO *);
+SIMPLE_EXTERNAL_CLASS(ssl_session_cache, std::shared_ptr<SessionCache> *);
+SIMPLE_EXTERNAL_CLASS(ssl_ticket_keys, std::shared_ptr<TicketKeys> *);
+SIMPLE_EXTERNAL_CLASS(x509_store, X509_STORE *);
+struct TlsEngine;
+SIMPLE_EXTERNAL_CLASS(tls_engine, TlsEngine *);
+static void tls_engine_free(TlsEngine * engine);
+SIMPLE_EXTERNAL_CLASS(evp_md_ctx, EVP_MD_CTX *);
+SIMPLE_EXTERNAL_CLASS(evp_mac_ctx, EVP_MAC_CTX *);
+SIMPLE_EXTERNAL_CLASS(evp_cipher_ctx, EVP_CIPHER_CTX *);
 
 // IO Unit
 extern "C" lean_object *initialize_native()
@@ -27,6 +206,30 @@ extern "C" lean_object *initialize_native()
                                                           {
         auto bio = static_cast<BIO *>(ptr);
         BIO_free_all(bio); }, [](void *obj, lean_object *fn) {});
+  EXTERNAL_CLASS_NAME(ssl_session_cache) = lean_register_external_class([](void *ptr)
+                                                                        {
+        auto cache = static_cast<std::shared_ptr<SessionCache> *>(ptr);
+        delete cache; }, [](void *obj, lean_object *fn) {});
+  EXTERNAL_CLASS_NAME(ssl_ticket_keys) = lean_register_external_class([](void *ptr)
+                                                                      {
+        auto keys = static_cast<std::shared_ptr<TicketKeys> *>(ptr);
+        delete keys; }, [](void *obj, lean_object *fn) {});
+  EXTERNAL_CLASS_NAME(x509_store) = lean_register_external_class([](void *ptr)
+                                                                 {
+        auto store = static_cast<X509_STORE *>(ptr);
+        X509_STORE_free(store); }, [](void *obj, lean_object *fn) {});
+  EXTERNAL_CLASS_NAME(tls_engine) = lean_register_external_class([](void *ptr)
+                                                                 {
+        tls_engine_free(static_cast<TlsEngine *>(ptr)); }, [](void *obj, lean_object *fn) {});
+  EXTERNAL_CLASS_NAME(evp_md_ctx) = lean_register_external_class([](void *ptr)
+                                                                 {
+        EVP_MD_CTX_free(static_cast<EVP_MD_CTX *>(ptr)); }, [](void *obj, lean_object *fn) {});
+  EXTERNAL_CLASS_NAME(evp_mac_ctx) = lean_register_external_class([](void *ptr)
+                                                                  {
+        EVP_MAC_CTX_free(static_cast<EVP_MAC_CTX *>(ptr)); }, [](void *obj, lean_object *fn) {});
+  EXTERNAL_CLASS_NAME(evp_cipher_ctx) = lean_register_external_class([](void *ptr)
+                                                                     {
+        EVP_CIPHER_CTX_free(static_cast<EVP_CIPHER_CTX *>(ptr)); }, [](void *obj, lean_object *fn) {});
   return lean_io_result_mk_ok(lean_box(0));
 }
 
@@ -90,172 +293,276 @@ extern "C" lean_object *ssl_ssl_ctx_new(lean_object *method)
   SSL_FALLIBLE_NULL_ON_ERROR_IO_EC(SSL_CTX_new(meth));
 }
 
-class LeanStreamCtx
+// Counters mirror the fields of `Metrics` in FFI.lean, in order.
+enum Metric : unsigned
 {
-public:
-  LeanObjRef stream;
-  LeanObjRef pending_read_task;
-  LeanObjRef pending_send_task;
-  size_t pending_send_len;
-  LeanObjRef pending_flush_task;
-  LeanStreamCtx(LeanObjRef s) : stream(s) {}
+  METRIC_HANDSHAKES,
+  METRIC_HANDSHAKES_RESUMED,
+  METRIC_HANDSHAKE_CPU_NS,
+  METRIC_HANDSHAKE_WAIT_NS,
+  METRIC_RECORDS_SENT,
+  METRIC_RECORDS_RECEIVED,
+  METRIC_BYTES_SENT,
+  METRIC_BYTES_RECEIVED,
+  METRIC_RETRY_READ,
+  METRIC_RETRY_WRITE,
+  METRIC_RETRY_IO_SPECIAL,
+  METRIC_TASK_POLLS,
+  METRIC_TASK_POLLS_PENDING,
+  METRIC_BUFFER_BYTES_ALLOCATED,
+  METRIC_COUNT,
 };
 
-typedef struct StreamOps
+// Relaxed atomics only: counters are read as independent values, never as a consistent snapshot.
+struct Metrics
 {
-  enum class Status : int {
-    FATAL = -1,
-    AGAIN = 0,
-    SUCCESS = 1
-  };
-  // Return values convention (you choose; this example uses):
-  //   1 = success, 0 = would-block/try again, -1 = fatal error (set *err)
-  std::unique_ptr<LeanStreamCtx> ctx;
-  std::function<Status(LeanStreamCtx *ctx, unsigned char *buf, size_t len, size_t *out_n, LeanObjRef & err)> read;
-  std::function<Status(LeanStreamCtx *ctx, const unsigned char *buf, size_t len, size_t *out_n, LeanObjRef & err)> write;
-  std::function<Status(LeanStreamCtx *ctx, LeanObjRef & err)> flush;
-  // StreamOps() = delete;
-  // TODO: remove default constructor
-} StreamOps;
-
-typedef struct StreamBioState
-{
-  StreamOps ops;
-  LeanObjRef last_err; // for debugging
-  StreamBioState() = delete;
-  StreamBioState(StreamOps && o) : ops(std::move(o)) {}
-} StreamBioState;
+  std::atomic<uint64_t> v[METRIC_COUNT] = {};
 
-static int streambio_create(BIO *b)
+  void add(Metric m, uint64_t n) { v[m].fetch_add(n, std::memory_order_relaxed); }
+  uint64_t get(Metric m) const { return v[m].load(std::memory_order_relaxed); }
+};
+
+// Process-wide counters, sharded by thread so that connections running on different cores
+// do not contend on the same cache lines. Reading adds up the shards.
+static const size_t METRIC_SHARDS = 64;
+
+struct alignas(64) MetricsShard
 {
-  BIO_set_data(b, nullptr); // we'll set data after BIO_new()
-  return 1;
+  Metrics metrics;
+};
+
+static MetricsShard global_metric_shards[METRIC_SHARDS];
+
+static Metrics & global_metrics()
+{
+  static std::atomic<unsigned> next_shard{0};
+  thread_local unsigned shard = next_shard.fetch_add(1, std::memory_order_relaxed) % METRIC_SHARDS;
+  return global_metric_shards[shard].metrics;
 }
 
-static int streambio_destroy(BIO *b)
+// Handshake durations in microseconds, bucket `i` counts durations in `[2^(i-1), 2^i)`.
+static const size_t HANDSHAKE_HISTOGRAM_BUCKETS = 32;
+static std::atomic<uint64_t> handshake_histogram[HANDSHAKE_HISTOGRAM_BUCKETS] = {};
+
+// Count into the process-wide aggregate, and into a connection's own counters if there are any.
+static inline void count(Metrics * local, Metric m, uint64_t n = 1)
 {
-  if (b == nullptr)
-    return 0;
-  StreamBioState *st = (StreamBioState *)BIO_get_data(b);
-  delete st;
-  BIO_set_data(b, nullptr);
-  return 1;
+  global_metrics().add(m, n);
+  if (local != nullptr)
+    local->add(m, n);
 }
 
-// BIO_meth_set_read_ex callback signature uses BIO_read_ex semantics
-static int streambio_read_ex(BIO *b, char *out, size_t outl, size_t *readbytes)
+static inline uint64_t now_ns()
 {
-  if (readbytes)
-    *readbytes = 0;
-  StreamBioState *st = (StreamBioState *)BIO_get_data(b); // store/retrieve custom data
-  if (!st || !st->ops.read || !out)
-    return 0;
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-  BIO_clear_retry_flags(b);
+enum class StreamStatus : int {
+  FATAL = -1, // fatal error, `err` is set
+  AGAIN = 0,  // would-block, try again later
+  SUCCESS = 1
+};
 
-  size_t n = 0;
-  StreamOps::Status rc = st->ops.read(st->ops.ctx.get(), (unsigned char *)out, outl, &n, st->last_err);
+// A source/sink BIO over `Transport`, dispatched statically: each transport type gets its own
+// `BIO_METHOD` and BIO type, and the transport is stored inline as the BIO's data.
+// A transport provides
+//   static constexpr const char * NAME;
+//   StreamStatus read(unsigned char *buf, size_t len, size_t *out_n, LeanObjRef & err);
+//   StreamStatus write(const unsigned char *buf, size_t len, size_t *out_n, LeanObjRef & err);
+//   StreamStatus flush(LeanObjRef & err);
+//   size_t pending();  // bytes readable without blocking
+//   size_t wpending(); // bytes accepted but not handed to the peer yet
+template <typename Transport>
+class StreamBio
+{
+public:
+  Transport transport;
+  LeanObjRef last_err; // for debugging
 
-  switch(rc) {
-  case StreamOps::Status::SUCCESS:
-    if (readbytes)
-      *readbytes = n;
-    return 1; // success
-  case StreamOps::Status::AGAIN:
-    // would-block / try again later
-    BIO_set_retry_read(b);
-    return 0;
-  case StreamOps::Status::FATAL:
-  default:
-    return 0;
+  template <typename... Args>
+  explicit StreamBio(Args &&... args) : transport(std::forward<Args>(args)...) {}
+
+  // A unique type so that the BIO can be found in a chain with `BIO_find_type`.
+  static int type()
+  {
+    static int t = BIO_get_new_index() | BIO_TYPE_SOURCE_SINK;
+    return t;
   }
-}
 
-// BIO_meth_set_write_ex callback signature uses BIO_write_ex semantics
-static int streambio_write_ex(BIO *b, const char *in, size_t inl, size_t *written)
-{
-  if (written)
-    *written = 0;
-  StreamBioState *st = (StreamBioState *)BIO_get_data(b);
-  if (!st || !st->ops.write || (!in && inl != 0))
-    return 0;
+  static BIO_METHOD *method()
+  {
+    static BIO_METHOD *m = [] {
+      // type: source/sink is appropriate for a transport BIO
+      BIO_METHOD *m = BIO_meth_new(type(), Transport::NAME);
+      assert(m != nullptr);
+      if (!m)
+        return m;
+      BIO_meth_set_create(m, create);
+      BIO_meth_set_destroy(m, destroy);
+      BIO_meth_set_read_ex(m, read_ex);
+      BIO_meth_set_write_ex(m, write_ex);
+      BIO_meth_set_ctrl(m, ctrl);
+      return m;
+    }();
+    return m;
+  }
 
-  BIO_clear_retry_flags(b);
+  // Takes ownership of `st`, which is freed together with the BIO.
+  static BIO *make(StreamBio *st)
+  {
+    BIO_METHOD *m = method();
+    BIO *b = m ? BIO_new(m) : nullptr;
+    if (!b)
+    {
+      delete st;
+      return nullptr;
+    }
+    BIO_set_data(b, st);
+    BIO_set_init(b, 1);
+    return b;
+  }
 
-  size_t n = 0;
-  StreamOps::Status rc = st->ops.write(st->ops.ctx.get(), (const unsigned char *)in, inl, &n, st->last_err);
+  static StreamBio *find(BIO *chain)
+  {
+    BIO *b = BIO_find_type(chain, type());
+    return b == nullptr ? nullptr : (StreamBio *)BIO_get_data(b);
+  }
 
-  switch(rc) {
-  case StreamOps::Status::SUCCESS:
-    if (written)
-      *written = n;
+private:
+  static int create(BIO *b)
+  {
+    BIO_set_data(b, nullptr); // we'll set data after BIO_new()
     return 1;
-  case StreamOps::Status::AGAIN:
-    BIO_set_retry_write(b);
-    return 0;
-  case StreamOps::Status::FATAL:
-  default:
-    return 0;
   }
-}
 
-static long streambio_ctrl(BIO *b, int cmd, long num, void *ptr)
-{
-  (void)num;
-  (void)ptr;
-  StreamBioState *st = (StreamBioState *)BIO_get_data(b);
+  static int destroy(BIO *b)
+  {
+    if (b == nullptr)
+      return 0;
+    delete (StreamBio *)BIO_get_data(b);
+    BIO_set_data(b, nullptr);
+    return 1;
+  }
 
-  switch (cmd)
+  // BIO_meth_set_read_ex callback signature uses BIO_read_ex semantics
+  static int read_ex(BIO *b, char *out, size_t outl, size_t *readbytes)
   {
-  case BIO_CTRL_FLUSH:
-    // SSL_set_bio requires custom wbio to support BIO_flush via BIO_CTRL_FLUSH
-    if (st && st->ops.flush)
-    {
-      BIO_clear_retry_flags(b);
-      StreamOps::Status rc = st->ops.flush(st->ops.ctx.get(), st->last_err);
-      return (rc == StreamOps::Status::SUCCESS) ? 1 : 0;
-    }
-    return 1; // "no-op flush" is acceptable if flushing unnecessary
+    if (readbytes)
+      *readbytes = 0;
+    StreamBio *st = (StreamBio *)BIO_get_data(b);
+    if (!st || !out)
+      return 0;
 
-  default:
-    return 0;
+    BIO_clear_retry_flags(b);
+
+    size_t n = 0;
+    switch (st->transport.read((unsigned char *)out, outl, &n, st->last_err)) {
+    case StreamStatus::SUCCESS:
+      if (readbytes)
+        *readbytes = n;
+      return 1;
+    case StreamStatus::AGAIN:
+      BIO_set_retry_read(b);
+      return 0;
+    case StreamStatus::FATAL:
+    default:
+      return 0;
+    }
   }
-}
 
-const char * LEAN_STREAM_BIO_NAME = "lean-stream-bio";
+  // BIO_meth_set_write_ex callback signature uses BIO_write_ex semantics
+  static int write_ex(BIO *b, const char *in, size_t inl, size_t *written)
+  {
+    if (written)
+      *written = 0;
+    StreamBio *st = (StreamBio *)BIO_get_data(b);
+    if (!st || (!in && inl != 0))
+      return 0;
 
-static BIO_METHOD *streambio_method()
-{
-  static BIO_METHOD *m = nullptr;
-  if (m != nullptr)
-    return m;
+    BIO_clear_retry_flags(b);
 
-  // type: source/sink is appropriate for a transport BIO
-  m = BIO_meth_new(BIO_TYPE_SOURCE_SINK, LEAN_STREAM_BIO_NAME);
-  assert(m != nullptr);
-  if (!m)
-    return nullptr;
+    size_t n = 0;
+    switch (st->transport.write((const unsigned char *)in, inl, &n, st->last_err)) {
+    case StreamStatus::SUCCESS:
+      if (written)
+        *written = n;
+      return 1;
+    case StreamStatus::AGAIN:
+      BIO_set_retry_write(b);
+      return 0;
+    case StreamStatus::FATAL:
+    default:
+      return 0;
+    }
+  }
 
-  BIO_meth_set_create(m, streambio_create);
-  BIO_meth_set_destroy(m, streambio_destroy);
-  BIO_meth_set_read_ex(m, streambio_read_ex);
-  BIO_meth_set_write_ex(m, streambio_write_ex);
-  BIO_meth_set_ctrl(m, streambio_ctrl);
-  return m;
-}
+  static long ctrl(BIO *b, int cmd, long num, void *ptr)
+  {
+    (void)num;
+    (void)ptr;
+    StreamBio *st = (StreamBio *)BIO_get_data(b);
+    if (!st)
+      return cmd == BIO_CTRL_FLUSH ? 1 : 0;
+
+    switch (cmd)
+    {
+    case BIO_CTRL_FLUSH: {
+      // SSL_set_bio requires custom wbio to support BIO_flush via BIO_CTRL_FLUSH
+      BIO_clear_retry_flags(b);
+      StreamStatus rc = st->transport.flush(st->last_err);
+      if (rc == StreamStatus::AGAIN)
+        BIO_set_retry_write(b);
+      return (rc == StreamStatus::SUCCESS) ? 1 : 0;
+    }
+    case BIO_CTRL_PENDING:
+      return (long)st->transport.pending();
+    case BIO_CTRL_WPENDING:
+      return (long)st->transport.wpending();
+    default:
+      return 0;
+    }
+  }
+};
 
-static BIO *BIO_new_stream(StreamBioState *state)
+class LeanStreamCtx
 {
-  BIO_METHOD *m = streambio_method();
-  if (!m)
-    return nullptr;
-  BIO *b = BIO_new(m);
-  if (!b)
-    return nullptr;
-  BIO_set_data(b, state); // attach your per-stream state
-  BIO_set_init(b, 1);
-  return b;
-}
+public:
+  LeanObjRef stream;
+  LeanObjRef pending_read_task;
+  LeanObjRef pending_send_task;
+  LeanObjRef pending_flush_task;
+  // Outgoing bytes gathered until a flush or until a batch is full, see `lean_write`.
+  LeanObjRef tx_buf;
+  // The `ByteArray` owned by the in-flight send, and a pooled one ready for reuse.
+  LeanObjRef tx_inflight;
+  LeanObjRef tx_spare;
+  // Received bytes OpenSSL has not asked for yet: `rx_buf[rx_off..]`.
+  // The `ByteArray` returned by `recv` is kept as is, never copied.
+  LeanObjRef rx_buf;
+  size_t rx_off = 0;
+  // Task polls and batch allocations of this stream, see `BIO.metrics`.
+  Metrics metrics;
+  // Low-memory mode: finished send buffers are dropped instead of pooled in `tx_spare`.
+  bool low_memory = false;
+  LeanStreamCtx(LeanObjRef s) : stream(s) {}
+
+  static constexpr const char * NAME = "lean-stream-bio";
+  StreamStatus read(unsigned char *buf, size_t len, size_t *out_n, LeanObjRef & err);
+  StreamStatus write(const unsigned char *buf, size_t len, size_t *out_n, LeanObjRef & err);
+  StreamStatus flush(LeanObjRef & err);
+  size_t pending() { return rx_buf.is_unit() ? 0 : lean_sarray_size(rx_buf) - rx_off; } // without another `recv`
+  size_t wpending() { return tx_buf.is_unit() ? 0 : lean_sarray_size(tx_buf); }          // not handed to `send` yet
+
+  // Capacity of the buffers held right now, not counting the closures.
+  size_t buffer_bytes()
+  {
+    size_t total = 0;
+    for (LeanObjRef * b : {&tx_buf, &tx_inflight, &tx_spare, &rx_buf})
+      total += b->is_unit() ? 0 : lean_sarray_capacity(*b);
+    return total;
+  }
+};
 
 // BaseIO a -> a
 static LeanObjRef unwrap_base_io(LeanObjRef x)
@@ -265,18 +572,15 @@ static LeanObjRef unwrap_base_io(LeanObjRef x)
   return LeanObjRef(y);
 }
 
-static LeanObjRef mk_byte_array_from_buf(const unsigned char *buf, size_t len)
-{
-  lean_obj_res ba = lean_alloc_sarray(/*elem_size*/ 1, /*size*/ len, /*cap*/ len);
-  memcpy(lean_sarray_cptr(ba), buf, len);
-  return LeanObjRef(ba);
-}
-
-static StreamOps::Status poll_task(LeanObjRef & task, LeanObjRef & res, LeanObjRef & err)
+static StreamStatus poll_task(Metrics & metrics, LeanObjRef & task, LeanObjRef & res, LeanObjRef & err)
 {
+  count(&metrics, METRIC_TASK_POLLS);
   uint8_t st = lean_io_get_task_state_core(task); // 0 waiting, 1 running, 2 finished
   if (st == 0 || st == 1)
-    return StreamOps::Status::AGAIN; // would-block
+  {
+    count(&metrics, METRIC_TASK_POLLS_PENDING);
+    return StreamStatus::AGAIN; // would-block
+  }
 
   // finished
   LeanObjRef except = task.task_get(); // blocks only if not finished
@@ -286,40 +590,165 @@ static StreamOps::Status poll_task(LeanObjRef & task, LeanObjRef & res, LeanObjR
   if (lean_obj_tag(except) == 0)
   {
     err = except.ctor_get(0);
-    return StreamOps::Status::FATAL;
+    return StreamStatus::FATAL;
   }
   // Except.ok
   res = except.ctor_get(0);
-  return StreamOps::Status::SUCCESS;
+  return StreamStatus::SUCCESS;
 }
 
-static StreamOps::Status poll_unit_task(LeanObjRef & task, LeanObjRef & err)
+static StreamStatus poll_unit_task(Metrics & metrics, LeanObjRef & task, LeanObjRef & err)
 {
   LeanObjRef tmp;
-  return poll_task(task, tmp, err);
+  return poll_task(metrics, task, tmp, err);
 }
 
 // lean_obj_res lean_io_error_to_string(lean_obj_arg err);
 
-static StreamOps::Status lean_read(LeanStreamCtx *ctx, unsigned char *buf, size_t len, size_t *out_n, LeanObjRef & err)
+// Gathered bytes are sent without waiting for a flush once a batch reaches this size.
+static const size_t LEAN_STREAM_SEND_SIZE = 64 * 1024;
+
+// Poll the in-flight send. A finished send's `ByteArray` is pooled if nobody else holds it anymore.
+static StreamStatus poll_send(LeanStreamCtx *ctx, LeanObjRef & err)
 {
-  if (!ctx->pending_read_task.is_unit())
+  if (ctx->pending_send_task.is_unit())
+    return StreamStatus::SUCCESS;
+  StreamStatus r = poll_unit_task(ctx->metrics, ctx->pending_send_task, err);
+  if (r != StreamStatus::SUCCESS)
+    return r;
+  if (!ctx->low_memory && ctx->tx_spare.is_unit() && lean_is_exclusive(ctx->tx_inflight))
   {
-    LeanObjRef data;
-    StreamOps::Status r = poll_task(ctx->pending_read_task, data, err);
-    if (r == StreamOps::Status::SUCCESS)
+    lean_sarray_set_size(ctx->tx_inflight, 0);
+    ctx->tx_spare.swap(ctx->tx_inflight);
+  }
+  ctx->tx_inflight.steal_drop();
+  return r;
+}
+
+// Hand `tx_buf` to `send`. Must only be called while no send is in flight.
+static StreamStatus start_send(LeanStreamCtx *ctx, LeanObjRef & err)
+{
+  LeanObjRef ba;
+  ba.swap(ctx->tx_buf);
+  LeanObjRef send = ctx->stream.ctor_get(1);  // ByteArray -> Async Unit
+  lean_inc(send);
+  LeanObjRef unit_async(lean_apply_1(send, ba.dup().steal())); // Async Unit
+  LeanObjRef maybe_task = unwrap_base_io(unit_async); // MaybeTask (Except IO.Error Unit)
+
+  auto tag = lean_obj_tag(maybe_task);
+  LeanObjRef inner = maybe_task.ctor_get(0);
+  if (tag == 0) {
+    if (lean_obj_tag(inner) == 0)
+    { // error
+      err = inner.ctor_get(0);
+      return StreamStatus::FATAL;
+    }
+    // ok
+    if (!ctx->low_memory && ctx->tx_spare.is_unit() && lean_is_exclusive(ba))
     {
-      size_t n = lean_sarray_size(data);
-      if (n > len)
-        n = len; // TODO: throw error? The stream implementation cannot return more than requested.
-      memcpy(buf, lean_sarray_cptr(data), n);
-      *out_n = n;
+      lean_sarray_set_size(ba, 0);
+      ctx->tx_spare.swap(ba);
+    }
+    return StreamStatus::SUCCESS;
+  } else {
+    // stash it and report would-block
+    ctx->pending_send_task.swap(inner);
+    ctx->tx_inflight.swap(ba);
+    return StreamStatus::AGAIN;
+  }
+}
+
+// Make room for `len` more bytes in `tx_buf`, reusing the pooled array when possible.
+static void tx_reserve(LeanStreamCtx *ctx, size_t len)
+{
+  if (ctx->tx_buf.is_unit())
+  {
+    if (!ctx->tx_spare.is_unit() && lean_sarray_capacity(ctx->tx_spare) >= len)
+    {
+      ctx->tx_buf.swap(ctx->tx_spare);
+    }
+    else
+    {
+      size_t capacity = std::max(len, LEAN_STREAM_SEND_SIZE);
+      count(&ctx->metrics, METRIC_BUFFER_BYTES_ALLOCATED, capacity);
+      LeanObjRef fresh(lean_alloc_sarray(1, 0, capacity));
+      ctx->tx_buf.swap(fresh);
     }
+    return;
+  }
+  size_t size = lean_sarray_size(ctx->tx_buf);
+  size_t capacity = lean_sarray_capacity(ctx->tx_buf);
+  if (size + len <= capacity)
+    return;
+  size_t new_capacity = std::max(size + len, 2 * capacity);
+  count(&ctx->metrics, METRIC_BUFFER_BYTES_ALLOCATED, new_capacity);
+  LeanObjRef grown(lean_alloc_sarray(1, size, new_capacity));
+  memcpy(lean_sarray_cptr(grown), lean_sarray_cptr(ctx->tx_buf), size);
+  ctx->tx_buf.swap(grown);
+}
+
+static size_t tx_size(LeanStreamCtx *ctx)
+{
+  return ctx->tx_buf.is_unit() ? 0 : lean_sarray_size(ctx->tx_buf);
+}
+
+// OpenSSL reads a record header and body separately, so ask the stream for at least a full record
+// and serve the remainder from `rx_buf`.
+static const size_t LEAN_STREAM_RECV_SIZE = SSL3_RT_MAX_PLAIN_LENGTH + SSL3_RT_MAX_ENCRYPTED_OVERHEAD + SSL3_RT_HEADER_LENGTH;
+
+static size_t serve_rx_buf(LeanStreamCtx *ctx, unsigned char *buf, size_t len)
+{
+  size_t size = lean_sarray_size(ctx->rx_buf);
+  size_t n = std::min(len, size - ctx->rx_off);
+  memcpy(buf, lean_sarray_cptr(ctx->rx_buf) + ctx->rx_off, n);
+  ctx->rx_off += n;
+  if (ctx->rx_off == size)
+  {
+    ctx->rx_buf.steal_drop();
+    ctx->rx_off = 0;
+  }
+  return n;
+}
+
+// An empty `ByteArray` means end of stream and is reported as a successful read of 0 bytes.
+static void stash_rx_buf(LeanStreamCtx *ctx, LeanObjRef & data, unsigned char *buf, size_t len, size_t *out_n)
+{
+  if (lean_sarray_size(data) == 0)
+  {
+    *out_n = 0;
+    return;
+  }
+  ctx->rx_buf.swap(data);
+  ctx->rx_off = 0;
+  *out_n = serve_rx_buf(ctx, buf, len);
+}
+
+static StreamStatus lean_read(LeanStreamCtx *ctx, unsigned char *buf, size_t len, size_t *out_n, LeanObjRef & err)
+{
+  // the peer may be waiting for gathered bytes that were never flushed
+  if (poll_send(ctx, err) == StreamStatus::FATAL)
+    return StreamStatus::FATAL;
+  if (ctx->pending_send_task.is_unit() && tx_size(ctx) > 0)
+  {
+    if (start_send(ctx, err) == StreamStatus::FATAL)
+      return StreamStatus::FATAL;
+  }
+  if (!ctx->rx_buf.is_unit())
+  {
+    *out_n = serve_rx_buf(ctx, buf, len);
+    return StreamStatus::SUCCESS;
+  }
+  if (!ctx->pending_read_task.is_unit())
+  {
+    LeanObjRef data;
+    StreamStatus r = poll_task(ctx->metrics, ctx->pending_read_task, data, err);
+    if (r == StreamStatus::SUCCESS)
+      stash_rx_buf(ctx, data, buf, len, out_n);
     return r;
   }
   LeanObjRef recv = ctx->stream.ctor_get(0);              // USize → Async ByteArray
   lean_inc(recv);
-  LeanObjRef bs_async(lean_apply_1(recv, lean_box_usize(len))); // Async ByteArray
+  LeanObjRef bs_async(lean_apply_1(recv, lean_box_usize(std::max(len, LEAN_STREAM_RECV_SIZE)))); // Async ByteArray
   LeanObjRef maybe = unwrap_base_io(bs_async);            // Std.Internal.IO.Async.MaybeTask (Except IO.Error ByteArray)
 
   if (lean_obj_tag(maybe) == 0)
@@ -330,81 +759,69 @@ static StreamOps::Status lean_read(LeanStreamCtx *ctx, unsigned char *buf, size_
     if (lean_obj_tag(except) == 0)
     {
       err = except.ctor_get(0);
-      return StreamOps::Status::FATAL;
+      return StreamStatus::FATAL;
     }
     else
     {
       LeanObjRef bs = except.ctor_get(0);
-      size_t n = lean_sarray_size(bs);
-      if (n > len)
-        n = len;
-      memcpy(buf, lean_sarray_cptr(bs), n);
-      *out_n = n;
-      return StreamOps::Status::SUCCESS;
+      stash_rx_buf(ctx, bs, buf, len, out_n);
+      return StreamStatus::SUCCESS;
     }
   }
   else
   { // MaybeTask.ofTask
     LeanObjRef task = maybe.ctor_get(0); // Task (Except ...)
     ctx->pending_read_task.swap(task); // stash it
-    return StreamOps::Status::AGAIN;
+    return StreamStatus::AGAIN;
   }
 }
 
-static StreamOps::Status lean_write(LeanStreamCtx *ctx, const unsigned char *buf, size_t len,
+// Bytes are copied into `tx_buf` and reported as written immediately; they are sent on flush,
+// once a batch is full, or before the next read. While a send is in flight, writes keep
+// gathering into the next batch and only block once that batch is full.
+static StreamStatus lean_write(LeanStreamCtx *ctx, const unsigned char *buf, size_t len,
                       size_t *out_n, LeanObjRef & err)
 {
   *out_n = 0;
+  StreamStatus r = poll_send(ctx, err);
+  if (r == StreamStatus::FATAL)
+    return r;
+  size_t queued = tx_size(ctx);
+  if (r == StreamStatus::AGAIN && queued + len > LEAN_STREAM_SEND_SIZE)
+    return StreamStatus::AGAIN; // back-pressure
 
-  // If we already have a pending send task, just poll it.
-  if (!ctx->pending_send_task.is_unit())
-  {
-    StreamOps::Status r = poll_unit_task(ctx->pending_send_task, err);
-    if (r == StreamOps::Status::SUCCESS)
-    {
-      *out_n = ctx->pending_send_len; // the bytes that are now confirmed sent
-      ctx->pending_send_len = 0;
-    }
-    return r; // 1 success, 0 wouldblock, -1 fatal
-  }
-
-  LeanObjRef ba = mk_byte_array_from_buf(buf, len); // ByteArray
-  LeanObjRef send = ctx->stream.ctor_get(1);  // ByteArray -> Async Unit
-  lean_inc(send);
-  lean_inc(ba);
-  LeanObjRef unit_async(lean_apply_1(send, ba)); // Async Unit
-  LeanObjRef maybe_task = unwrap_base_io(unit_async); // MaybeTask (Except IO.Error Unit)
-
-  auto tag = lean_obj_tag(maybe_task);
-  LeanObjRef inner = maybe_task.ctor_get(0);
-  if (tag == 0) {
-    if (lean_obj_tag(inner) == 0)
-    { // error
-      err = inner.ctor_get(0);
-      *out_n = 0;
-      return StreamOps::Status::FATAL;
-    }
-    else
-    { // ok
-      *out_n = len;
-      return StreamOps::Status::SUCCESS;
-    }
-  } else {
-    // stash it and report would-block
-    ctx->pending_send_task.swap(inner);
-    ctx->pending_send_len = len;
+  tx_reserve(ctx, len);
+  memcpy(lean_sarray_cptr(ctx->tx_buf) + queued, buf, len);
+  lean_sarray_set_size(ctx->tx_buf, queued + len);
+  *out_n = len;
 
-    *out_n = 0;
-    return StreamOps::Status::AGAIN;
+  if (r == StreamStatus::SUCCESS && queued + len >= LEAN_STREAM_SEND_SIZE)
+  {
+    if (start_send(ctx, err) == StreamStatus::FATAL)
+      return StreamStatus::FATAL;
   }
+  return StreamStatus::SUCCESS;
 }
 
-static StreamOps::Status lean_flush(LeanStreamCtx *ctx, LeanObjRef & err)
+static StreamStatus lean_flush(LeanStreamCtx *ctx, LeanObjRef & err)
 {
+  // Send everything gathered so far, one send at a time
+  while (true)
+  {
+    StreamStatus r = poll_send(ctx, err);
+    if (r != StreamStatus::SUCCESS)
+      return r;
+    if (tx_size(ctx) == 0)
+      break;
+    r = start_send(ctx, err);
+    if (r != StreamStatus::SUCCESS)
+      return r;
+  }
+
   // Poll pending flush first
   if (!ctx->pending_flush_task.is_unit())
   {
-    return poll_unit_task(ctx->pending_flush_task, err);
+    return poll_unit_task(ctx->metrics, ctx->pending_flush_task, err);
   }
 
   LeanObjRef flush_async = ctx->stream.ctor_get(2); // Async Unit
@@ -416,214 +833,3132 @@ static StreamOps::Status lean_flush(LeanStreamCtx *ctx, LeanObjRef & err)
     if (lean_obj_tag(inner) == 0)
     {
       err = inner.ctor_get(0);
-      return StreamOps::Status::FATAL;
+      return StreamStatus::FATAL;
     }
     else
     {
-      return StreamOps::Status::SUCCESS;
+      return StreamStatus::SUCCESS;
     }
   } else {
     ctx->pending_flush_task.swap(inner);
-    return StreamOps::Status::AGAIN;
+    return StreamStatus::AGAIN;
   }
 }
 
+StreamStatus LeanStreamCtx::read(unsigned char *buf, size_t len, size_t *out_n, LeanObjRef & err)
+{
+  return lean_read(this, buf, len, out_n, err);
+}
+
+StreamStatus LeanStreamCtx::write(const unsigned char *buf, size_t len, size_t *out_n, LeanObjRef & err)
+{
+  return lean_write(this, buf, len, out_n, err);
+}
+
+StreamStatus LeanStreamCtx::flush(LeanObjRef & err)
+{
+  return lean_flush(this, err);
+}
+
 // Stream -> IO BIO
 extern "C" lean_obj_res bio_of_stream(lean_obj_arg stream)
 {
-  std::unique_ptr<LeanStreamCtx> ctx = std::make_unique<LeanStreamCtx>(std::move(LeanStreamCtx(LeanObjRef(stream))));
-  StreamBioState *st = new StreamBioState(std::move(StreamOps{std::move(ctx), lean_read, lean_write, lean_flush}));
-  SSL_FALLIBLE_NULL_ON_ERROR_IO_EC(BIO_new_stream(st));
+  // The closures are applied from whichever thread drives the BIO, and marking the BIO's
+  // external object does not reach them, so they must be multi-threaded objects up front.
+  lean_mark_mt(stream);
+  auto st = new StreamBio<LeanStreamCtx>(LeanObjRef(stream));
+  SSL_FALLIBLE_NULL_ON_ERROR_IO_EC(StreamBio<LeanStreamCtx>::make(st));
 }
 
-// BaseIO (Array String)
-extern "C" lean_obj_res ssl_errors()
+static LeanStreamCtx * find_stream_ctx(BIO * bio)
 {
-  std::vector<std::string> err_res = std::vector<std::string>();
-  const size_t BUFSIZE = 1024;
-  auto buf = std::make_unique<char[]>(BUFSIZE);
-  unsigned long e = 0;
-  while ((e = ERR_get_error()) != 0)
+  auto st = StreamBio<LeanStreamCtx>::find(bio);
+  return st == nullptr ? nullptr : &st->transport;
+}
+
+// Both directions of an in-memory connection, shared by its two ends.
+struct LoopbackPipe
+{
+  std::mutex mutex;
+  std::vector<unsigned char> data[2]; // `data[i][read_off[i]..]` is yet to be read by end `i`
+  size_t read_off[2] = {0, 0};
+  bool closed[2] = {false, false};    // end `i` has been freed
+};
+
+// One end of an in-memory connection, for tests and benchmarks.
+// Reading an empty pipe would-block until the other end writes, or reports end of stream once it is freed.
+class LoopbackTransport
+{
+private:
+  std::shared_ptr<LoopbackPipe> m_pipe;
+  int m_end;
+
+public:
+  static constexpr const char * NAME = "lean-loopback-bio";
+  LoopbackTransport(std::shared_ptr<LoopbackPipe> pipe, int end) : m_pipe(std::move(pipe)), m_end(end) {}
+  LoopbackTransport(const LoopbackTransport &) = delete;
+  ~LoopbackTransport()
   {
-    ERR_error_string_n(e, buf.get(), BUFSIZE);
-    err_res.push_back(buf.get());
+    std::lock_guard<std::mutex> lock(m_pipe->mutex);
+    m_pipe->closed[m_end] = true;
   }
-  auto arr = lean_alloc_array(err_res.size(), err_res.size());
-  for (size_t i = 0; i < err_res.size(); i++)
+
+  StreamStatus read(unsigned char *buf, size_t len, size_t *out_n, LeanObjRef & err)
   {
-    auto s = err_res[i];
-    auto str = lean_mk_string_from_bytes(s.c_str(), s.size());
-    lean_array_set_core(arr, i, str);
+    std::lock_guard<std::mutex> lock(m_pipe->mutex);
+    auto & data = m_pipe->data[m_end];
+    size_t & off = m_pipe->read_off[m_end];
+    size_t n = std::min(len, data.size() - off);
+    if (n == 0)
+    {
+      *out_n = 0;
+      return m_pipe->closed[1 - m_end] ? StreamStatus::SUCCESS : StreamStatus::AGAIN;
+    }
+    memcpy(buf, data.data() + off, n);
+    off += n;
+    if (off == data.size())
+    {
+      data.clear();
+      off = 0;
+    }
+    *out_n = n;
+    return StreamStatus::SUCCESS;
   }
-  return arr;
-}
+
+  StreamStatus write(const unsigned char *buf, size_t len, size_t *out_n, LeanObjRef & err)
+  {
+    std::lock_guard<std::mutex> lock(m_pipe->mutex);
+    *out_n = 0;
+    if (m_pipe->closed[1 - m_end])
+    {
+      err = LeanObjRef(lean_mk_io_user_error(lean_mk_string("loopback BIO: the other end is closed")));
+      return StreamStatus::FATAL;
+    }
+    auto & data = m_pipe->data[1 - m_end];
+    data.insert(data.end(), buf, buf + len);
+    *out_n = len;
+    return StreamStatus::SUCCESS;
+  }
+
+  StreamStatus flush(LeanObjRef & err) { return StreamStatus::SUCCESS; }
+
+  size_t pending()
+  {
+    std::lock_guard<std::mutex> lock(m_pipe->mutex);
+    return m_pipe->data[m_end].size() - m_pipe->read_off[m_end];
+  }
+
+  size_t wpending() { return 0; }
+};
 
 // IO (BIO × BIO)
-extern "C" lean_obj_res bio_new_pair()
+extern "C" lean_obj_res bio_new_loopback_pair()
 {
-  BIO *b1, *b2;
-  ERR_clear_error();
-  if (!BIO_new_bio_pair(&b1, 0, &b2, 0))
+  auto pipe = std::make_shared<LoopbackPipe>();
+  BIO *b1 = StreamBio<LoopbackTransport>::make(new StreamBio<LoopbackTransport>(pipe, 0));
+  BIO *b2 = StreamBio<LoopbackTransport>::make(new StreamBio<LoopbackTransport>(pipe, 1));
+  if (b1 == nullptr || b2 == nullptr)
+  {
+    BIO_free(b1);
+    BIO_free(b2);
     return lean_io_result_mk_error(error_to_io_user_error());
-  auto b1_ = wrapEC<BIO *>(b1);
-  auto b2_ = wrapEC<BIO *>(b2);
+  }
   auto pair = lean_alloc_ctor(0, 2, 0); // Prod.mk
-  lean_ctor_set(pair, 0, b1_);
-  lean_ctor_set(pair, 1, b2_);
+  lean_ctor_set(pair, 0, wrapEC<BIO *>(b1));
+  lean_ctor_set(pair, 1, wrapEC<BIO *>(b2));
   return lean_io_result_mk_ok(pair);
 }
 
-// BIO -> BIO -> BaseIO BIO
-extern "C" lean_obj_res bio_push(lean_obj_arg a, lean_obj_arg b)
+// The task stays stashed in the stream BIO, which consumes its result on the next retry.
+static lean_obj_res mk_option_task(LeanObjRef & task)
 {
-  BIO * a_ = unwrapEC<BIO *>(a);
-  BIO * b_ = unwrapEC<BIO *>(b);
-  BIO * r = BIO_push(a_, b_);
-  BIO_up_ref(b_);
-  lean_dec(b); // If the caller does not hold it anymore, then the external object is finalized, and BIO refcount will be decremented at once.
-  return a;
+  if (task.is_unit())
+    return lean_box(0); // Option.none
+  lean_obj_res some = lean_alloc_ctor(1, 1, 0);
+  lean_ctor_set(some, 0, task.dup().steal());
+  return some;
 }
 
-// @& SSLContext -> Int32 -> IO BIO
-extern "C" lean_obj_res bio_ssl(b_lean_obj_arg ctx, int client)
+// @& BIO -> BaseIO (Option (Task (Except IO.Error ByteArray)))
+extern "C" lean_obj_res bio_pending_recv_task(b_lean_obj_arg bio)
 {
-  auto ctx_ = unwrapEC<SSL_CTX *>(ctx);
-  SSL_FALLIBLE_NULL_ON_ERROR_IO_EC(BIO_new_ssl(ctx_, client));
+  LeanStreamCtx * ctx = find_stream_ctx(unwrapEC<BIO *>(bio));
+  if (ctx == nullptr)
+    return lean_box(0);
+  return mk_option_task(ctx->pending_read_task);
 }
 
-// Contract: BIOs must set exactly one retry flag among read/write/io_special.
-lean_obj_res handle_retry_error(BIO * bio) {
-  if (!BIO_should_retry(bio)) {
-    std::string err_res = get_all_error();
-    lean_obj_res err = lean_mk_string_from_bytes(err_res.c_str(), err_res.size());
-    return lean_io_result_mk_error(lean_mk_io_user_error(err));
+// @& BIO -> BaseIO (Option (Task (Except IO.Error Unit)))
+extern "C" lean_obj_res bio_pending_send_task(b_lean_obj_arg bio)
+{
+  LeanStreamCtx * ctx = find_stream_ctx(unwrapEC<BIO *>(bio));
+  if (ctx == nullptr)
+    return lean_box(0);
+  return mk_option_task(ctx->pending_send_task);
+}
+
+// @& BIO -> BaseIO (Option (Task (Except IO.Error Unit)))
+extern "C" lean_obj_res bio_pending_flush_task(b_lean_obj_arg bio)
+{
+  LeanStreamCtx * ctx = find_stream_ctx(unwrapEC<BIO *>(bio));
+  if (ctx == nullptr)
+    return lean_box(0);
+  return mk_option_task(ctx->pending_flush_task);
+}
+
+// Waits for socket readiness on a background thread and wakes the waiting Lean task.
+// Every wait is one-shot: the waiter is dropped once its `wake : BaseIO Unit` has run.
+// There is at most one reader and one writer per fd, the pollfd set is only updated for fds whose waiters changed.
+class FdReactor
+{
+private:
+  struct Slot
+  {
+    LeanObjRef read_wake;
+    LeanObjRef write_wake;
+    short events() { return (read_wake.is_unit() ? 0 : POLLIN) | (write_wake.is_unit() ? 0 : POLLOUT); }
+  };
+  std::mutex m_mutex;
+  std::unordered_map<int, Slot> m_slots;
+  std::vector<int> m_changed; // fds whose waiters were added since the last `poll`
+  int m_wakeup[2] = {-1, -1}; // self-pipe, interrupts `poll` when a waiter is added
+
+  // Owned by the reactor thread: `m_fds[0]` is the self-pipe, `m_index` maps the other fds to their position.
+  std::vector<pollfd> m_fds;
+  std::unordered_map<int, size_t> m_index;
+
+  FdReactor()
+  {
+    if (pipe(m_wakeup) != 0)
+      lean_panic("FdReactor: pipe() failed", true);
+    fcntl(m_wakeup[0], F_SETFL, O_NONBLOCK);
+    fcntl(m_wakeup[1], F_SETFL, O_NONBLOCK);
+    std::thread([this] { this->run(); }).detach();
   }
-  if (BIO_should_read(bio)) {
-    return lean_io_result_mk_error(lean_mk_io_error_resource_exhausted(EAGAIN, lean_mk_string("SHOULD_READ")));
+
+  void set_events(int fd, short events)
+  {
+    auto it = m_index.find(fd);
+    if (it == m_index.end()) {
+      if (events != 0) {
+        m_index.emplace(fd, m_fds.size());
+        m_fds.push_back({fd, events, 0});
+      }
+      return;
+    }
+    if (events != 0) {
+      m_fds[it->second].events = events;
+      return;
+    }
+    size_t pos = it->second;
+    m_index.erase(it);
+    if (pos + 1 != m_fds.size()) {
+      m_fds[pos] = m_fds.back();
+      m_index[m_fds[pos].fd] = pos;
+    }
+    m_fds.pop_back();
   }
-  if (BIO_should_write(bio)) {
-    return lean_io_result_mk_error(lean_mk_io_error_resource_exhausted(EAGAIN, lean_mk_string("SHOULD_WRITE")));
+
+  // Take the waiters of `fd` that `revents` satisfies. Errors and hangups wake both directions.
+  void take_ready(int fd, short revents, std::vector<LeanObjRef> & ready)
+  {
+    auto it = m_slots.find(fd);
+    if (it == m_slots.end()) {
+      set_events(fd, 0);
+      return;
+    }
+    bool failed = revents & (POLLERR | POLLHUP | POLLNVAL);
+    if ((failed || (revents & POLLIN)) && !it->second.read_wake.is_unit())
+      ready.push_back(LeanObjRef(it->second.read_wake.steal()));
+    if ((failed || (revents & POLLOUT)) && !it->second.write_wake.is_unit())
+      ready.push_back(LeanObjRef(it->second.write_wake.steal()));
+    short events = it->second.events();
+    if (events == 0)
+      m_slots.erase(it);
+    set_events(fd, events);
   }
-  if (BIO_should_io_special(bio)) {
-    return lean_io_result_mk_error(lean_mk_io_error_resource_exhausted(EAGAIN, lean_mk_string("SHOULD_IO_SPECIAL")));
+
+  void run()
+  {
+    lean_initialize_thread();
+    m_fds.push_back({m_wakeup[0], POLLIN, 0});
+    std::vector<int> changed;
+    std::vector<LeanObjRef> ready;
+    while (true)
+    {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        changed.swap(m_changed);
+        for (int fd : changed) {
+          auto it = m_slots.find(fd);
+          set_events(fd, it == m_slots.end() ? 0 : it->second.events());
+        }
+      }
+      changed.clear();
+      int n = poll(m_fds.data(), m_fds.size(), -1);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        // e.g. more fds than RLIMIT_NOFILE: wake everyone, their next I/O reports their own state,
+        // and back off instead of failing the same `poll` in a loop
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          for (auto & [fd, slot] : m_slots) {
+            if (!slot.read_wake.is_unit())
+              ready.push_back(LeanObjRef(slot.read_wake.steal()));
+            if (!slot.write_wake.is_unit())
+              ready.push_back(LeanObjRef(slot.write_wake.steal()));
+          }
+          m_slots.clear();
+          m_fds.resize(1);
+          m_index.clear();
+        }
+        for (auto & wake : ready)
+          lean_dec(lean_apply_1(wake.steal(), lean_io_mk_world()));
+        ready.clear();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        continue;
+      }
+      if (m_fds[0].revents != 0) {
+        char buf[64];
+        while (::read(m_wakeup[0], buf, sizeof(buf)) > 0) {}
+      }
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // iterate backwards: `take_ready` may move the last entry into the current position
+        for (size_t i = m_fds.size() - 1; i > 0 && n > 0; i--) {
+          if (m_fds[i].revents == 0)
+            continue;
+          n--;
+          short revents = m_fds[i].revents;
+          m_fds[i].revents = 0;
+          take_ready(m_fds[i].fd, revents, ready);
+        }
+      }
+      // run the callbacks outside the lock, they may register new waiters
+      for (auto & wake : ready)
+        lean_dec(lean_apply_1(wake.steal(), lean_io_mk_world()));
+      ready.clear();
+    }
   }
-  lean_panic("handle_retry_error: BIO_should_retry returns true with no retry flag set.", true);
-  return lean_io_result_mk_error(lean_mk_io_user_error(lean_mk_string("handle_retry_error: BIO_should_retry returns true with no retry flag set.")));
+
+public:
+  static FdReactor & get()
+  {
+    static FdReactor * reactor = new FdReactor(); // never destroyed, the thread runs until exit
+    return *reactor;
+  }
+
+  // `wake` must already be marked MT, it is run on the reactor thread.
+  void add(int fd, bool for_write, LeanObjRef wake)
+  {
+    LeanObjRef replaced;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      Slot & slot = m_slots[fd];
+      LeanObjRef & target = for_write ? slot.write_wake : slot.read_wake;
+      target.swap(replaced);
+      target.swap(wake);
+      m_changed.push_back(fd);
+    }
+    // a second waiter for the same direction supersedes the first, which just retries
+    if (!replaced.is_unit())
+      lean_dec(lean_apply_1(replaced.steal(), lean_io_mk_world()));
+    char c = 0;
+    (void)!::write(m_wakeup[1], &c, 1);
+  }
+};
+
+static lean_obj_res mk_io_errno_error(const char * what)
+{
+  std::string msg = std::string(what) + ": " + strerror(errno);
+  return lean_io_result_mk_error(lean_mk_io_user_error(lean_mk_string_from_bytes(msg.c_str(), msg.size())));
 }
 
-// @& BIO -> USize -> IO ByteArray
-extern "C" lean_obj_res bio_read(b_lean_obj_arg bio, size_t len)
+#ifdef __linux__
+
+// An operation in flight on the `Uring`, its address is the entry's `user_data`.
+struct UringOp
 {
-  auto bio_ = unwrapEC<BIO *>(bio);
-  auto arr = lean_alloc_sarray(1, 0, len); // ByteArray
-  size_t read_bytes = 0;
-  ERR_clear_error();
-  if (!BIO_read_ex(bio_, lean_sarray_cptr(arr), len, &read_bytes))
+  virtual ~UringOp() = default;
+  // Called on the completion thread. Multishot operations are called until `IORING_CQE_F_MORE` is unset,
+  // then the operation is deleted.
+  virtual void complete(int res, unsigned flags) = 0;
+  // Called instead of `complete` if the entry never reaches the kernel, then the operation is deleted.
+  virtual void abandon(int err) = 0;
+};
+
+// One io_uring shared by every `bio_uring_connect` connection, set up on first use with raw system calls.
+// Submissions are batched over all connections: a thread that queues an entry while another one is already
+// entering the kernel leaves it to that one, which submits everything queued meanwhile in the same call.
+// Entries wait in `m_pending` while the submission queue is full. The completion thread never enters the
+// kernel from `submit`, since the kernel may be waiting for it to drain completions first: what completions
+// submit is queued, and entered once the completions at hand are done.
+// If the kernel refuses submissions for good, the ring fails, and with it every queued and later operation.
+// Receives are multishot into a ring of provided buffers, and copied out on completion
+// so a connection that is slow to read never holds on to the shared buffers.
+class Uring
+{
+public:
+  static constexpr unsigned ENTRIES = 1024;
+  static constexpr unsigned BUFFERS = 1024; // a power of two
+  static constexpr unsigned BUFFER_SIZE = 16 * 1024;
+  static constexpr uint16_t BUFFER_GROUP = 0;
+
+  std::atomic<uint64_t> submits{0};
+  std::atomic<uint64_t> entries{0};
+  std::atomic<uint64_t> completions{0};
+  // Cleared when the kernel rejects multishot receives, which then fall back to one receive per entry.
+  std::atomic<bool> multishot{true};
+
+  // `nullptr` if the kernel has no usable io_uring.
+  static Uring * get()
   {
-    lean_dec(arr);
-    return handle_retry_error(bio_);
+    static Uring * ring = [] {
+      auto r = new Uring();
+      if (r->setup()) {
+        std::thread([r] { r->run(); }).detach();
+        return r;
+      }
+      delete r;
+      return (Uring *)nullptr;
+    }();
+    return ring;
   }
-  lean_sarray_set_size(arr, read_bytes);
-  return lean_io_result_mk_ok(arr);
+
+  // Queue an entry for `op`, which is owned by the ring from here on. `fill` sets all but `user_data`.
+  template <typename Fill>
+  void submit(UringOp * op, Fill fill)
+  {
+    io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    fill(&sqe);
+    sqe.user_data = (uint64_t)(uintptr_t)op;
+    std::unique_lock lock(m_sq_mutex);
+    if (m_error != 0) {
+      int err = m_error;
+      lock.unlock();
+      op->abandon(err);
+      delete op;
+      return;
+    }
+    m_pending.push_back(sqe);
+    if (s_completing)
+      return;
+    flush(lock);
+  }
+
+  // 0, or the errno the kernel refused submissions with.
+  int error()
+  {
+    std::lock_guard<std::mutex> lock(m_sq_mutex);
+    return m_error;
+  }
+
+  unsigned char * buffer(unsigned bid) { return m_buffers + (size_t)bid * BUFFER_SIZE; }
+
+  // Give a provided buffer back to the kernel. Only called on the completion thread.
+  void recycle(unsigned bid)
+  {
+    // not `bufs[i]`: in C++ the header's flexible array member starts after a 1 byte empty struct
+    io_uring_buf * b = reinterpret_cast<io_uring_buf *>(m_buf_ring) + (m_buf_tail & (BUFFERS - 1));
+    b->addr = (uint64_t)(uintptr_t)buffer(bid);
+    b->len = BUFFER_SIZE;
+    b->bid = (uint16_t)bid;
+    __atomic_store_n(&m_buf_ring->tail, ++m_buf_tail, __ATOMIC_RELEASE);
+  }
+
+private:
+  int m_fd = -1;
+  std::mutex m_sq_mutex;
+  unsigned m_sq_entries = 0;
+  unsigned m_sq_mask = 0;
+  unsigned m_sq_tail = 0; // our copy of `*m_sq_tail_ptr`
+  unsigned * m_sq_head = nullptr;
+  unsigned * m_sq_tail_ptr = nullptr;
+  unsigned * m_sq_array = nullptr;
+  io_uring_sqe * m_sqes = nullptr;
+  std::deque<io_uring_sqe> m_pending; // not in the submission queue yet
+  unsigned m_unsubmitted = 0; // in the submission queue, not taken by the kernel yet
+  bool m_submitting = false;
+  int m_error = 0;
+  static inline thread_local bool s_completing = false;
+  unsigned m_cq_mask = 0;
+  unsigned * m_cq_head = nullptr;
+  unsigned * m_cq_tail = nullptr;
+  io_uring_cqe * m_cqes = nullptr;
+  io_uring_buf_ring * m_buf_ring = nullptr;
+  uint16_t m_buf_tail = 0;
+  unsigned char * m_buffers = nullptr;
+
+  Uring() = default;
+  // Mappings are kept if setup fails half way, it only happens once per process.
+  ~Uring()
+  {
+    if (m_fd >= 0)
+      close(m_fd);
+  }
+
+  bool setup()
+  {
+    io_uring_params p = {};
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = 8 * ENTRIES; // multishot receives complete many times per entry
+    m_fd = (int)syscall(__NR_io_uring_setup, ENTRIES, &p);
+    if (m_fd < 0)
+      return false;
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single)
+      sq_size = cq_size = std::max(sq_size, cq_size);
+    auto sq = (unsigned char *)mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED)
+      return false;
+    auto cq = single ? sq : (unsigned char *)mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+    if (cq == MAP_FAILED)
+      return false;
+    auto sqes = mmap(nullptr, p.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+      return false;
+    m_sq_entries = p.sq_entries;
+    m_sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    m_sq_head = (unsigned *)(sq + p.sq_off.head);
+    m_sq_tail_ptr = (unsigned *)(sq + p.sq_off.tail);
+    m_sq_tail = *m_sq_tail_ptr;
+    m_sq_array = (unsigned *)(sq + p.sq_off.array);
+    m_sqes = (io_uring_sqe *)sqes;
+    m_cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    m_cq_head = (unsigned *)(cq + p.cq_off.head);
+    m_cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    m_cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    // untouched buffers cost no resident memory
+    auto ring = mmap(nullptr, BUFFERS * sizeof(io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    auto buffers = mmap(nullptr, (size_t)BUFFERS * BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED || buffers == MAP_FAILED)
+      return false;
+    m_buf_ring = (io_uring_buf_ring *)ring;
+    m_buffers = (unsigned char *)buffers;
+    io_uring_buf_reg reg = {};
+    reg.ring_addr = (uint64_t)(uintptr_t)ring;
+    reg.ring_entries = BUFFERS;
+    reg.bgid = BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+      return false;
+    for (unsigned bid = 0; bid < BUFFERS; bid++)
+      recycle(bid);
+    return true;
+  }
+
+  // Submit everything queued, unless another thread already is. Requires the lock, which is released
+  // while entering the kernel. On the completion thread, gives up when the kernel waits for completions.
+  void flush(std::unique_lock<std::mutex> & lock)
+  {
+    if (m_submitting)
+      return;
+    m_submitting = true;
+    while (m_error == 0 && (!m_pending.empty() || m_unsubmitted > 0)) {
+      while (!m_pending.empty() && m_sq_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) < m_sq_entries) {
+        unsigned idx = m_sq_tail & m_sq_mask;
+        m_sqes[idx] = m_pending.front();
+        m_pending.pop_front();
+        m_sq_array[idx] = idx;
+        __atomic_store_n(m_sq_tail_ptr, ++m_sq_tail, __ATOMIC_RELEASE);
+        m_unsubmitted++;
+      }
+      unsigned n = m_unsubmitted;
+      lock.unlock();
+      long r = syscall(__NR_io_uring_enter, m_fd, n, 0, 0, nullptr, 0);
+      int err = r < 0 ? errno : 0;
+      lock.lock();
+      if (r > 0) {
+        submits.fetch_add(1, std::memory_order_relaxed);
+        entries.fetch_add(r, std::memory_order_relaxed);
+        m_unsubmitted -= (unsigned)r;
+      } else if (r == 0 || err == EAGAIN || err == EBUSY) {
+        // the completion queue is backed up: the completion thread drains it, then submits the rest
+        if (s_completing)
+          break;
+        lock.unlock();
+        std::this_thread::yield();
+        lock.lock();
+      } else if (err != EINTR) {
+        fail(err, lock);
+      }
+    }
+    m_submitting = false;
+  }
+
+  // Stop submitting for good and abandon every operation not taken by the kernel. Requires the lock.
+  void fail(int err, std::unique_lock<std::mutex> & lock)
+  {
+    m_error = err;
+    std::vector<UringOp *> ops;
+    // without a polling thread the kernel only reads entries while entering, so untaken ones can be dropped
+    for (unsigned i = m_sq_tail - m_unsubmitted; i != m_sq_tail; i++)
+      ops.push_back((UringOp *)(uintptr_t)m_sqes[m_sq_array[i & m_sq_mask]].user_data);
+    m_sq_tail -= m_unsubmitted;
+    __atomic_store_n(m_sq_tail_ptr, m_sq_tail, __ATOMIC_RELEASE);
+    m_unsubmitted = 0;
+    for (auto & sqe : m_pending)
+      ops.push_back((UringOp *)(uintptr_t)sqe.user_data);
+    m_pending.clear();
+    lock.unlock();
+    for (auto op : ops) {
+      op->abandon(err);
+      delete op;
+    }
+    lock.lock();
+  }
+
+  void run()
+  {
+    lean_initialize_thread();
+    s_completing = true;
+    bool queued = false;
+    while (true) {
+      // with entries left to submit, only look for completions instead of waiting for one
+      unsigned wait = queued ? 0 : 1;
+      if (syscall(__NR_io_uring_enter, m_fd, 0, wait, IORING_ENTER_GETEVENTS, nullptr, 0) < 0
+          && errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+        int err = errno;
+        {
+          // a submitting thread runs into the same error and fails the ring itself
+          std::unique_lock lock(m_sq_mutex);
+          if (m_error == 0 && !m_submitting)
+            fail(err, lock);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      unsigned head = *m_cq_head;
+      unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+      for (; head != tail; head++) {
+        io_uring_cqe * cqe = &m_cqes[head & m_cq_mask];
+        auto op = (UringOp *)(uintptr_t)cqe->user_data;
+        int res = cqe->res;
+        unsigned flags = cqe->flags;
+        __atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+        completions.fetch_add(1, std::memory_order_relaxed);
+        op->complete(res, flags);
+        if (!(flags & IORING_CQE_F_MORE))
+          delete op;
+      }
+      std::unique_lock lock(m_sq_mutex);
+      flush(lock);
+      // unless another thread is submitting, which does not give up
+      queued = m_error == 0 && !m_submitting && (!m_pending.empty() || m_unsubmitted > 0);
+      lock.unlock();
+      if (queued)
+        std::this_thread::yield();
+    }
+  }
+};
+
+static void run_wake(LeanObjRef & wake)
+{
+  if (!wake.is_unit())
+    lean_dec(lean_apply_1(wake.steal(), lean_io_mk_world()));
 }
 
-// @& BIO -> ByteArray -> IO Unit
-extern "C" lean_obj_res bio_write(b_lean_obj_arg bio, lean_obj_arg bs)
+// The state of one io_uring connection, shared by its BIO and its operations in flight,
+// so the socket is only closed once the last of them is gone.
+struct UringConn
 {
-  auto bio_ = unwrapEC<BIO *>(bio);
-  size_t written = 0;
-  ERR_clear_error();
-  if (!BIO_write_ex(bio_, lean_sarray_cptr(bs), lean_sarray_size(bs), &written))
+  static constexpr size_t RX_LIMIT = 256 * 1024; // stop receiving while this much is unread
+  static constexpr size_t TX_BATCH = 64 * 1024;  // send without waiting for a flush
+  static constexpr size_t TX_LIMIT = 256 * 1024; // writes would-block while a send is in flight
+
+  std::mutex mutex;
+  int fd;
+  // Received bytes OpenSSL has not asked for yet: `rx[rx_off..]`.
+  std::vector<unsigned char> rx;
+  size_t rx_off = 0;
+  bool rx_eof = false;
+  bool recv_posted = false;
+  bool recv_paused = false;
+  bool connected = false;
+  int error = 0; // errno of the first failed operation
+  // Gathered outgoing bytes, and those owned by the send in flight: `tx_inflight[tx_sent..]` is left to send.
+  std::vector<unsigned char> tx;
+  std::vector<unsigned char> tx_inflight;
+  size_t tx_sent = 0;
+  bool send_inflight = false;
+  bool closed = false; // the BIO is gone
+  LeanObjRef read_wake;
+  LeanObjRef write_wake;
+
+  explicit UringConn(int fd) : fd(fd) {}
+  UringConn(const UringConn &) = delete;
+  ~UringConn() { close(fd); }
+
+  size_t rx_pending() { return rx.size() - rx_off; }
+
+  bool read_ready() { return error != 0 || rx_eof || rx_pending() > 0; }
+
+  bool write_ready() { return error != 0 || (connected && !send_inflight); }
+
+  // Hand the gathered bytes to a new send. Requires the lock, and no send in flight.
+  void begin_send()
   {
-    lean_dec(bs);
-    return handle_retry_error(bio_);
+    tx.swap(tx_inflight);
+    tx.clear();
+    tx_sent = 0;
+    send_inflight = true;
   }
-  lean_dec(bs);
-  return lean_io_result_mk_ok(lean_box(0));
+
+  void fail(int err, LeanObjRef & rwake, LeanObjRef & wwake)
+  {
+    if (error == 0)
+      error = err;
+    rwake.swap(read_wake);
+    wwake.swap(write_wake);
+  }
+};
+
+// Fail `conn` with `err`, for an operation on it the ring abandoned.
+static void uring_fail(const std::shared_ptr<UringConn> & conn, int err)
+{
+  LeanObjRef rwake, wwake;
+  {
+    std::lock_guard<std::mutex> lock(conn->mutex);
+    conn->fail(err, rwake, wwake);
+  }
+  run_wake(rwake);
+  run_wake(wwake);
 }
 
-// @& BIO -> IO Unit
-extern "C" lean_obj_res bio_flush(b_lean_obj_arg bio)
+static void uring_post_recv(const std::shared_ptr<UringConn> & conn);
+static void uring_post_send(const std::shared_ptr<UringConn> & conn, const unsigned char * data, size_t len);
+
+struct UringConnect : UringOp
 {
-  auto bio_ = unwrapEC<BIO *>(bio);
-  ERR_clear_error();
-  if (BIO_flush(bio_) != 1)
+  std::shared_ptr<UringConn> conn;
+  sockaddr_storage addr;
+  socklen_t addr_len;
+
+  void complete(int res, unsigned flags) override
   {
-    return handle_retry_error(bio_);
+    LeanObjRef rwake, wwake;
+    {
+      std::lock_guard<std::mutex> lock(conn->mutex);
+      if (res < 0) {
+        conn->fail(-res, rwake, wwake);
+      } else {
+        conn->connected = true;
+        wwake.swap(conn->write_wake);
+      }
+    }
+    run_wake(rwake);
+    run_wake(wwake);
   }
-  return lean_io_result_mk_ok(lean_box(0));
+
+  void abandon(int err) override { uring_fail(conn, err); }
+};
+
+struct UringRecv : UringOp
+{
+  std::shared_ptr<UringConn> conn;
+  bool multishot;
+
+  void complete(int res, unsigned flags) override
+  {
+    Uring * ring = Uring::get();
+    LeanObjRef rwake, wwake;
+    bool repost = false;
+    bool pause = false;
+    {
+      std::lock_guard<std::mutex> lock(conn->mutex);
+      if (res > 0 && (flags & IORING_CQE_F_BUFFER)) {
+        unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        if (conn->rx_off > 0 && conn->rx_off >= conn->rx.size() / 2) {
+          conn->rx.erase(conn->rx.begin(), conn->rx.begin() + conn->rx_off);
+          conn->rx_off = 0;
+        }
+        conn->rx.insert(conn->rx.end(), ring->buffer(bid), ring->buffer(bid) + res);
+        ring->recycle(bid);
+        rwake.swap(conn->read_wake);
+        pause = (flags & IORING_CQE_F_MORE) && !conn->recv_paused && conn->rx_pending() >= UringConn::RX_LIMIT;
+        if (pause)
+          conn->recv_paused = true;
+      } else if (res == 0) {
+        conn->rx_eof = true;
+        rwake.swap(conn->read_wake);
+      } else if (res == -EINVAL && multishot) {
+        ring->multishot = false; // a kernel without multishot receives, post single ones instead
+      } else if (res < 0 && res != -ENOBUFS && res != -ECANCELED) {
+        conn->fail(-res, rwake, wwake);
+      }
+      if (!(flags & IORING_CQE_F_MORE)) {
+        // the receive ended: out of buffers, not multishot in the first place, or cancelled,
+        // which the kernel also does when the thread that submitted it exits.
+        // Single receives pause here, without a cancel, once the reader falls behind.
+        if (conn->rx_pending() >= UringConn::RX_LIMIT)
+          conn->recv_paused = true;
+        repost = !conn->closed && !conn->rx_eof && conn->error == 0 && !conn->recv_paused;
+        conn->recv_posted = repost;
+      }
+    }
+    if (repost)
+      uring_post_recv(conn);
+    if (pause) {
+      // resumed by `UringTransport::read` once the reader caught up
+      uint64_t target = (uint64_t)(uintptr_t)this;
+      ring->submit(new UringCancel(), [&](io_uring_sqe * sqe) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = target;
+      });
+    }
+    run_wake(rwake);
+    run_wake(wwake);
+  }
+
+  void abandon(int err) override { uring_fail(conn, err); }
+
+  struct UringCancel : UringOp
+  {
+    void complete(int res, unsigned flags) override {}
+    // only once the ring failed, the receive just goes on
+    void abandon(int err) override {}
+  };
+};
+
+struct UringSend : UringOp
+{
+  std::shared_ptr<UringConn> conn;
+
+  void complete(int res, unsigned flags) override
+  {
+    LeanObjRef rwake, wwake;
+    const unsigned char * next = nullptr;
+    size_t next_len = 0;
+    {
+      std::lock_guard<std::mutex> lock(conn->mutex);
+      // cancelled when the submitting thread exited: send the rest again
+      if (res < 0 && res != -ECANCELED) {
+        conn->send_inflight = false;
+        conn->fail(-res, rwake, wwake);
+      } else {
+        conn->tx_sent += std::max(res, 0);
+        if (conn->tx_sent == conn->tx_inflight.size()) {
+          conn->send_inflight = false;
+          if (!conn->tx.empty() && !conn->closed)
+            conn->begin_send();
+          // either way there is room for more writes
+          wwake.swap(conn->write_wake);
+        }
+        if (conn->send_inflight) {
+          next = conn->tx_inflight.data() + conn->tx_sent;
+          next_len = conn->tx_inflight.size() - conn->tx_sent;
+        }
+      }
+    }
+    if (next != nullptr)
+      uring_post_send(conn, next, next_len);
+    run_wake(rwake);
+    run_wake(wwake);
+  }
+
+  void abandon(int err) override { uring_fail(conn, err); }
+};
+
+static void uring_post_recv(const std::shared_ptr<UringConn> & conn)
+{
+  Uring * ring = Uring::get();
+  auto op = new UringRecv();
+  op->conn = conn;
+  op->multishot = ring->multishot.load(std::memory_order_relaxed);
+  int fd = conn->fd;
+  bool multishot = op->multishot;
+  ring->submit(op, [&](io_uring_sqe * sqe) {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = Uring::BUFFER_GROUP;
+    if (multishot)
+      sqe->ioprio = IORING_RECV_MULTISHOT;
+    else
+      sqe->len = Uring::BUFFER_SIZE;
+  });
+}
+
+// `data` stays owned by `conn->tx_inflight` until the send completes.
+static void uring_post_send(const std::shared_ptr<UringConn> & conn, const unsigned char * data, size_t len)
+{
+  auto op = new UringSend();
+  op->conn = conn;
+  int fd = conn->fd;
+  Uring::get()->submit(op, [&](io_uring_sqe * sqe) {
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)data;
+    sqe->len = (unsigned)std::min(len, (size_t)UINT32_MAX);
+    sqe->msg_flags = MSG_NOSIGNAL;
+  });
+}
+
+// A socket driven by the shared `Uring`: the BIO reads from and writes to per-connection buffers the
+// completion thread fills and drains, so no Lean task runs per `recv`/`send`.
+// Waiting for progress goes through `bio_socket_wait` like the poll reactor's sockets,
+// the wake is run by the completion that makes progress.
+class UringTransport
+{
+private:
+  std::shared_ptr<UringConn> m_conn;
+
+public:
+  static constexpr const char * NAME = "lean-uring-bio";
+  explicit UringTransport(std::shared_ptr<UringConn> conn) : m_conn(std::move(conn)) {}
+  UringTransport(const UringTransport &) = delete;
+  ~UringTransport()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_conn->mutex);
+      m_conn->closed = true;
+      m_conn->read_wake.steal_drop();
+      m_conn->write_wake.steal_drop();
+    }
+    // ends the receive in flight, the socket is closed with the last operation
+    shutdown(m_conn->fd, SHUT_RDWR);
+  }
+
+  int fd() { return m_conn->fd; }
+
+  StreamStatus read(unsigned char *buf, size_t len, size_t *out_n, LeanObjRef & err)
+  {
+    bool resume = false;
+    {
+      std::lock_guard<std::mutex> lock(m_conn->mutex);
+      *out_n = 0;
+      size_t n = std::min(len, m_conn->rx_pending());
+      if (n == 0) {
+        if (m_conn->error != 0) {
+          err = LeanObjRef(lean_mk_io_user_error(lean_mk_string(strerror(m_conn->error))));
+          return StreamStatus::FATAL;
+        }
+        return m_conn->rx_eof ? StreamStatus::SUCCESS : StreamStatus::AGAIN;
+      }
+      memcpy(buf, m_conn->rx.data() + m_conn->rx_off, n);
+      m_conn->rx_off += n;
+      if (m_conn->rx_off == m_conn->rx.size()) {
+        m_conn->rx.clear();
+        m_conn->rx_off = 0;
+      }
+      *out_n = n;
+      if (m_conn->recv_paused && m_conn->rx_pending() < UringConn::RX_LIMIT / 2) {
+        m_conn->recv_paused = false;
+        resume = !m_conn->recv_posted;
+        m_conn->recv_posted = true;
+      }
+    }
+    if (resume)
+      uring_post_recv(m_conn);
+    return StreamStatus::SUCCESS;
+  }
+
+  StreamStatus write(const unsigned char *buf, size_t len, size_t *out_n, LeanObjRef & err)
+  {
+    const unsigned char * data = nullptr;
+    size_t data_len = 0;
+    {
+      std::lock_guard<std::mutex> lock(m_conn->mutex);
+      *out_n = 0;
+      if (m_conn->error != 0) {
+        err = LeanObjRef(lean_mk_io_user_error(lean_mk_string(strerror(m_conn->error))));
+        return StreamStatus::FATAL;
+      }
+      if (m_conn->tx.size() >= UringConn::TX_LIMIT)
+        return StreamStatus::AGAIN;
+      m_conn->tx.insert(m_conn->tx.end(), buf, buf + len);
+      *out_n = len;
+      if (!m_conn->send_inflight && m_conn->tx.size() >= UringConn::TX_BATCH) {
+        m_conn->begin_send();
+        data = m_conn->tx_inflight.data();
+        data_len = m_conn->tx_inflight.size();
+      }
+    }
+    if (data != nullptr)
+      uring_post_send(m_conn, data, data_len);
+    return StreamStatus::SUCCESS;
+  }
+
+  // Succeeds once everything written so far has been sent.
+  StreamStatus flush(LeanObjRef & err)
+  {
+    const unsigned char * data = nullptr;
+    size_t data_len = 0;
+    StreamStatus status;
+    {
+      std::lock_guard<std::mutex> lock(m_conn->mutex);
+      if (m_conn->error != 0) {
+        err = LeanObjRef(lean_mk_io_user_error(lean_mk_string(strerror(m_conn->error))));
+        return StreamStatus::FATAL;
+      }
+      if (!m_conn->send_inflight && !m_conn->tx.empty()) {
+        m_conn->begin_send();
+        data = m_conn->tx_inflight.data();
+        data_len = m_conn->tx_inflight.size();
+      }
+      status = m_conn->send_inflight ? StreamStatus::AGAIN : StreamStatus::SUCCESS;
+    }
+    if (data != nullptr)
+      uring_post_send(m_conn, data, data_len);
+    return status;
+  }
+
+  size_t pending()
+  {
+    std::lock_guard<std::mutex> lock(m_conn->mutex);
+    return m_conn->rx_pending();
+  }
+
+  size_t wpending()
+  {
+    std::lock_guard<std::mutex> lock(m_conn->mutex);
+    return m_conn->tx.size() + (m_conn->send_inflight ? m_conn->tx_inflight.size() - m_conn->tx_sent : 0);
+  }
+
+  // Runs `wake` once the connection can make progress in the given direction, right away if it already can.
+  void wait(bool write, LeanObjRef wake)
+  {
+    LeanObjRef ready;
+    {
+      std::lock_guard<std::mutex> lock(m_conn->mutex);
+      if (write ? m_conn->write_ready() : m_conn->read_ready()) {
+        ready.swap(wake);
+      } else {
+        LeanObjRef & slot = write ? m_conn->write_wake : m_conn->read_wake;
+        ready.swap(slot); // a superseded waiter retries on its own
+        slot.swap(wake);
+      }
+    }
+    run_wake(ready);
+  }
+
+  // The errno of a failed connect, or 0 once receiving has started.
+  int start_receiving()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_conn->mutex);
+      if (m_conn->error != 0)
+        return m_conn->error;
+      if (m_conn->recv_posted)
+        return 0;
+      m_conn->recv_posted = true;
+    }
+    uring_post_recv(m_conn);
+    return 0;
+  }
+};
+
+static UringTransport * find_uring(BIO * bio)
+{
+  auto st = StreamBio<UringTransport>::find(bio);
+  return st == nullptr ? nullptr : &st->transport;
+}
+
+#else
+
+// io_uring is Linux only, there are never any such BIOs elsewhere.
+class UringTransport
+{
+public:
+  int fd() { return -1; }
+  void wait(bool write, LeanObjRef wake) {}
+  int start_receiving() { return 0; }
+};
+
+static UringTransport * find_uring(BIO * bio)
+{
+  return nullptr;
+}
+
+#endif
+
+// Run `f` with SIGPIPE blocked on this thread and discard a SIGPIPE it raised, so a write to a reset peer
+// fails with EPIPE instead of killing the process. For writes that cannot pass `MSG_NOSIGNAL`.
+template <typename F>
+static auto without_sigpipe(F f) -> decltype(f())
+{
+#ifdef SO_NOSIGPIPE
+  return f(); // set on the socket itself
+#else
+  sigset_t pipe_set, old;
+  sigemptyset(&pipe_set);
+  sigaddset(&pipe_set, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &pipe_set, &old);
+  // a SIGPIPE that was already pending is not ours to discard
+  sigset_t pending;
+  sigpending(&pending);
+  bool was_pending = sigismember(&pending, SIGPIPE);
+  auto r = f();
+  int saved = errno;
+  if (!was_pending) {
+    timespec zero = {0, 0};
+    while (sigtimedwait(&pipe_set, nullptr, &zero) < 0 && errno == EINTR) {}
+  }
+  pthread_sigmask(SIG_SETMASK, &old, nullptr);
+  errno = saved;
+  return r;
+#endif
+}
+
+#ifdef MSG_NOSIGNAL
+static const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+static const int SEND_FLAGS = 0; // `SO_NOSIGPIPE` instead
+#endif
+
+static int socket_write(BIO * b, const char * data, int len)
+{
+  static auto inherited = BIO_meth_get_write(const_cast<BIO_METHOD *>(BIO_s_socket()));
+  // kernel TLS sends control records (alerts) with a cmsg, which only the inherited write knows about
+  if (BIO_get_ktls_send(b))
+    return without_sigpipe([&] { return inherited(b, data, len); });
+  BIO_clear_retry_flags(b);
+  errno = 0;
+  int n = (int)send(BIO_get_fd(b, nullptr), data, len, SEND_FLAGS);
+  if (n <= 0 && BIO_sock_should_retry(n))
+    BIO_set_retry_write(b);
+  return n;
+}
+
+// `BIO_s_socket`, but writing with `send(MSG_NOSIGNAL)`, so the library leaves the process' SIGPIPE disposition alone.
+// Keeps the socket type for `BIO_find_type` and kernel TLS.
+static const BIO_METHOD * socket_method()
+{
+  static BIO_METHOD * method = [] {
+    const BIO_METHOD * base = BIO_s_socket();
+    BIO_METHOD * m = BIO_meth_new(BIO_TYPE_SOCKET, "lean-socket");
+    BIO_meth_set_write(m, socket_write);
+    BIO_meth_set_read(m, BIO_meth_get_read(base));
+    BIO_meth_set_puts(m, BIO_meth_get_puts(base));
+    BIO_meth_set_gets(m, BIO_meth_get_gets(base));
+    BIO_meth_set_ctrl(m, BIO_meth_get_ctrl(base));
+    BIO_meth_set_create(m, BIO_meth_get_create(base));
+    BIO_meth_set_destroy(m, BIO_meth_get_destroy(base));
+    BIO_meth_set_callback_ctrl(m, BIO_meth_get_callback_ctrl(base));
+    return m;
+  }();
+  return method;
+}
+
+// -1 if there is no socket BIO in the chain
+static int find_socket_fd(BIO * bio)
+{
+  BIO * sb = BIO_find_type(bio, BIO_TYPE_SOCKET);
+  if (sb == nullptr)
+    return -1;
+  return BIO_get_fd(sb, nullptr);
+}
+
+// A numeric IPv4/IPv6 address, `false` for anything else.
+static bool parse_numeric_addr(const char * host, uint16_t port, sockaddr_storage & addr, socklen_t & addr_len)
+{
+  addr = {};
+  auto v4 = reinterpret_cast<sockaddr_in *>(&addr);
+  auto v6 = reinterpret_cast<sockaddr_in6 *>(&addr);
+  if (inet_pton(AF_INET, host, &v4->sin_addr) == 1) {
+    v4->sin_family = AF_INET;
+    v4->sin_port = htons(port);
+    addr_len = sizeof(sockaddr_in);
+    return true;
+  }
+  if (inet_pton(AF_INET6, host, &v6->sin6_addr) == 1) {
+    v6->sin6_family = AF_INET6;
+    v6->sin6_port = htons(port);
+    addr_len = sizeof(sockaddr_in6);
+    return true;
+  }
+  return false;
+}
+
+// String -> UInt16 -> IO BIO
+// Starts a non-blocking TCP connect to a numeric IPv4/IPv6 address.
+// Completion is signalled by writability, see `bio_socket_finish_connect`.
+extern "C" lean_obj_res bio_socket_connect(lean_obj_arg host, uint16_t port)
+{
+  sockaddr_storage addr;
+  socklen_t addr_len = 0;
+  bool parsed = parse_numeric_addr(lean_string_cstr(host), port, addr, addr_len);
+  lean_dec(host);
+  if (!parsed)
+    return lean_io_result_mk_error(lean_mk_io_user_error(lean_mk_string("bio_socket_connect: not a numeric address")));
+  int fd = socket(addr.ss_family, SOCK_STREAM, 0);
+  if (fd < 0)
+    return mk_io_errno_error("socket");
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  if (!BIO_socket_nbio(fd, 1)) {
+    close(fd);
+    return lean_io_result_mk_error(error_to_io_user_error());
+  }
+  if (connect(fd, reinterpret_cast<sockaddr *>(&addr), addr_len) != 0 && errno != EINPROGRESS) {
+    auto err = mk_io_errno_error("connect");
+    close(fd);
+    return err;
+  }
+  BIO * b = BIO_new(socket_method());
+  if (b == nullptr) {
+    close(fd);
+    return lean_io_result_mk_error(error_to_io_user_error());
+  }
+  BIO_set_fd(b, fd, BIO_CLOSE);
+  return lean_io_result_mk_ok(wrapEC(b));
+}
+
+// String -> UInt16 -> IO BIO
+// Like `bio_socket_connect`, but the socket is driven by the shared io_uring, see `UringTransport`.
+extern "C" lean_obj_res bio_uring_connect(lean_obj_arg host, uint16_t port)
+{
+  sockaddr_storage addr;
+  socklen_t addr_len = 0;
+  bool parsed = parse_numeric_addr(lean_string_cstr(host), port, addr, addr_len);
+  lean_dec(host);
+  if (!parsed)
+    return lean_io_result_mk_error(lean_mk_io_user_error(lean_mk_string("bio_uring_connect: not a numeric address")));
+#ifdef __linux__
+  Uring * ring = Uring::get();
+  if (ring == nullptr)
+    return lean_io_result_mk_error(lean_mk_io_user_error(lean_mk_string("bio_uring_connect: io_uring is not available")));
+  // blocking: the ring waits for readiness itself
+  int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return mk_io_errno_error("socket");
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  auto conn = std::make_shared<UringConn>(fd);
+  BIO * b = StreamBio<UringTransport>::make(new StreamBio<UringTransport>(conn));
+  if (b == nullptr)
+    return lean_io_result_mk_error(error_to_io_user_error());
+  auto op = new UringConnect();
+  op->conn = conn;
+  op->addr = addr;
+  op->addr_len = addr_len;
+  ring->submit(op, [&](io_uring_sqe * sqe) {
+    sqe->opcode = IORING_OP_CONNECT;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)&op->addr;
+    sqe->off = addr_len;
+  });
+  return lean_io_result_mk_ok(wrapEC(b));
+#else
+  return lean_io_result_mk_error(lean_mk_io_user_error(lean_mk_string("bio_uring_connect: io_uring is not available")));
+#endif
+}
+
+// BaseIO Bool
+extern "C" uint8_t uring_available()
+{
+#ifdef __linux__
+  Uring * ring = Uring::get();
+  return ring != nullptr && ring->error() == 0;
+#else
+  return 0;
+#endif
+}
+
+// BaseIO UringStats
+extern "C" lean_obj_res uring_stats()
+{
+  lean_object * r = lean_alloc_ctor(0, 0, 3 * sizeof(uint64_t));
+#ifdef __linux__
+  Uring * ring = Uring::get();
+  lean_ctor_set_uint64(r, 0, ring ? ring->submits.load() : 0);
+  lean_ctor_set_uint64(r, sizeof(uint64_t), ring ? ring->entries.load() : 0);
+  lean_ctor_set_uint64(r, 2 * sizeof(uint64_t), ring ? ring->completions.load() : 0);
+#else
+  for (unsigned i = 0; i < 3; i++)
+    lean_ctor_set_uint64(r, i * sizeof(uint64_t), 0);
+#endif
+  return r;
+}
+
+// @& BIO -> IO Unit
+extern "C" lean_obj_res bio_socket_finish_connect(b_lean_obj_arg bio)
+{
+  if (auto uring = find_uring(unwrapEC<BIO *>(bio))) {
+    int err = uring->start_receiving();
+    if (err == 0)
+      return lean_io_result_mk_ok(lean_box(0));
+    errno = err;
+    return mk_io_errno_error("connect");
+  }
+  int fd = find_socket_fd(unwrapEC<BIO *>(bio));
+  if (fd < 0)
+    return lean_io_result_mk_error(lean_mk_io_user_error(lean_mk_string("bio_socket_finish_connect: no socket BIO found in BIO chain")));
+  int so_error = 0;
+  socklen_t len = sizeof(so_error);
+  if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &so_error, &len) != 0)
+    return mk_io_errno_error("getsockopt");
+  if (so_error != 0) {
+    errno = so_error;
+    return mk_io_errno_error("connect");
+  }
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// @& BIO -> BaseIO Unit
+extern "C" lean_obj_res bio_socket_shutdown(b_lean_obj_arg bio)
+{
+  auto uring = find_uring(unwrapEC<BIO *>(bio));
+  int fd = uring ? uring->fd() : find_socket_fd(unwrapEC<BIO *>(bio));
+  if (fd >= 0)
+    shutdown(fd, SHUT_RDWR);
+  return lean_box(0);
+}
+
+// @& BIO -> Bool -> BaseIO Unit -> BaseIO Bool
+extern "C" uint8_t bio_socket_wait(b_lean_obj_arg bio, uint8_t write, lean_obj_arg wake)
+{
+  if (auto uring = find_uring(unwrapEC<BIO *>(bio))) {
+    lean_mark_mt(wake);
+    uring->wait(write, LeanObjRef(wake));
+    return 1;
+  }
+  int fd = find_socket_fd(unwrapEC<BIO *>(bio));
+  if (fd < 0) {
+    lean_dec(wake);
+    return 0;
+  }
+  lean_mark_mt(wake);
+  FdReactor::get().add(fd, write, LeanObjRef(wake));
+  return 1;
+}
+
+// BaseIO (Array String)
+extern "C" lean_obj_res ssl_errors()
+{
+  std::vector<std::string> err_res = std::vector<std::string>();
+  const size_t BUFSIZE = 1024;
+  auto buf = std::make_unique<char[]>(BUFSIZE);
+  unsigned long e = 0;
+  while ((e = ERR_get_error()) != 0)
+  {
+    ERR_error_string_n(e, buf.get(), BUFSIZE);
+    err_res.push_back(buf.get());
+  }
+  auto arr = lean_alloc_array(err_res.size(), err_res.size());
+  for (size_t i = 0; i < err_res.size(); i++)
+  {
+    auto s = err_res[i];
+    auto str = lean_mk_string_from_bytes(s.c_str(), s.size());
+    lean_array_set_core(arr, i, str);
+  }
+  return arr;
+}
+
+// IO (BIO × BIO)
+extern "C" lean_obj_res bio_new_pair()
+{
+  BIO *b1, *b2;
+  ERR_clear_error();
+  if (!BIO_new_bio_pair(&b1, 0, &b2, 0))
+    return lean_io_result_mk_error(error_to_io_user_error());
+  auto b1_ = wrapEC<BIO *>(b1);
+  auto b2_ = wrapEC<BIO *>(b2);
+  auto pair = lean_alloc_ctor(0, 2, 0); // Prod.mk
+  lean_ctor_set(pair, 0, b1_);
+  lean_ctor_set(pair, 1, b2_);
+  return lean_io_result_mk_ok(pair);
+}
+
+static void inherit_low_memory(BIO * chain);
+
+// BIO -> BIO -> BaseIO BIO
+extern "C" lean_obj_res bio_push(lean_obj_arg a, lean_obj_arg b)
+{
+  BIO * a_ = unwrapEC<BIO *>(a);
+  BIO * b_ = unwrapEC<BIO *>(b);
+  BIO * r = BIO_push(a_, b_);
+  BIO_up_ref(b_);
+  inherit_low_memory(a_);
+  lean_dec(b); // If the caller does not hold it anymore, then the external object is finalized, and BIO refcount will be decremented at once.
+  return a;
+}
+
+// Dynamic record sizing, see `bio_set_dynamic_records`.
+struct DynamicRecords
+{
+  size_t small_record = 0; // 0 if disabled
+  uint64_t threshold = 0;
+  uint64_t idle_ns = 0;
+};
+
+// Per-connection state attached to an `SSL` as ex_data, freed together with the `SSL`.
+struct ConnState
+{
+  std::shared_ptr<SessionCache> session_cache;
+  std::string session_key;
+  Metrics metrics;
+  // Handshake timing, see `timed_handshake`.
+  uint64_t handshake_start_ns = 0;
+  uint64_t handshake_cpu_ns = 0;
+  bool handshake_done = false;
+  // Writes are cut into records of `dynamic.small_record` bytes until `dynamic.threshold` bytes of application
+  // data went out, and again once the connection did not write for `dynamic.idle_ns`, see `dynamic_record_limit`.
+  DynamicRecords dynamic;
+  uint64_t dynamic_sent = 0;
+  uint64_t last_write_ns = 0;
+};
+
+static void conn_state_free(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp)
+{
+  delete static_cast<ConnState *>(ptr);
+}
+
+static int conn_state_index()
+{
+  static int idx = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, conn_state_free);
+  return idx;
+}
+
+static ConnState * get_conn_state(SSL * ssl, bool create)
+{
+  auto st = static_cast<ConnState *>(SSL_get_ex_data(ssl, conn_state_index()));
+  if (st == nullptr && create) {
+    st = new ConnState();
+    SSL_set_ex_data(ssl, conn_state_index(), st);
+  }
+  return st;
+}
+
+static SSL * get_ssl(BIO * bio)
+{
+  SSL * ssl = nullptr;
+  BIO_get_ssl(bio, &ssl);
+  return ssl;
+}
+
+static Metrics * conn_metrics(BIO * bio)
+{
+  SSL * ssl = get_ssl(bio);
+  ConnState * st = ssl == nullptr ? nullptr : get_conn_state(ssl, false);
+  return st == nullptr ? nullptr : &st->metrics;
+}
+
+// Counts records and their on-the-wire size from the record headers OpenSSL reports.
+static void record_msg_cb(int write_p, int version, int content_type, const void *buf, size_t len, SSL *ssl, void *arg)
+{
+  if (content_type != SSL3_RT_HEADER || len < SSL3_RT_HEADER_LENGTH)
+    return;
+  auto header = static_cast<const unsigned char *>(buf);
+  uint64_t bytes = SSL3_RT_HEADER_LENGTH + ((size_t)header[3] << 8 | header[4]);
+  ConnState * st = get_conn_state(ssl, false);
+  Metrics * local = st == nullptr ? nullptr : &st->metrics;
+  count(local, write_p ? METRIC_RECORDS_SENT : METRIC_RECORDS_RECEIVED);
+  count(local, write_p ? METRIC_BYTES_SENT : METRIC_BYTES_RECEIVED, bytes);
+  if (st != nullptr && write_p && header[0] == SSL3_RT_APPLICATION_DATA)
+    st->dynamic_sent += bytes;
+}
+
+// How much of a write goes into one record: `SIZE_MAX` unless the connection is in its small-record phase.
+static size_t dynamic_record_limit(BIO * bio)
+{
+  SSL * ssl = get_ssl(bio);
+  ConnState * st = ssl == nullptr ? nullptr : get_conn_state(ssl, false);
+  if (st == nullptr || st->dynamic.small_record == 0)
+    return SIZE_MAX;
+  uint64_t now = now_ns();
+  // a write that would-block must be retried with at least the same length, so never shrink in between
+  if (now - st->last_write_ns > st->dynamic.idle_ns && !SSL_want_write(ssl))
+    st->dynamic_sent = 0;
+  st->last_write_ns = now;
+  return st->dynamic_sent < st->dynamic.threshold ? st->dynamic.small_record : SIZE_MAX;
+}
+
+// `BIO_write_ex`, one record per `dynamic_record_limit` bytes. A would-block after some progress
+// reports the progress, the same as a partial write.
+static int write_sized(BIO * bio, const unsigned char * data, size_t len, size_t * written)
+{
+  size_t limit = dynamic_record_limit(bio);
+  if (len <= limit)
+    return BIO_write_ex(bio, data, len, written);
+  size_t total = 0;
+  while (total < len) {
+    size_t n = 0;
+    if (!BIO_write_ex(bio, data + total, std::min(limit, len - total), &n)) {
+      if (total == 0)
+        return 0;
+      break;
+    }
+    total += n;
+    limit = dynamic_record_limit(bio);
+  }
+  *written = total;
+  return 1;
+}
+
+static void dynamic_records_free(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp)
+{
+  delete static_cast<DynamicRecords *>(ptr);
+}
+
+// The default `DynamicRecords` of a context's connections.
+static int dynamic_records_index()
+{
+  static int idx = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, dynamic_records_free);
+  return idx;
+}
+
+// `BIO_do_handshake`, accounting the time spent inside OpenSSL separately from the time
+// spent waiting for the peer between calls.
+static long timed_handshake(BIO * bio)
+{
+  SSL * ssl = get_ssl(bio);
+  ConnState * st = ssl == nullptr ? nullptr : get_conn_state(ssl, false);
+  if (st == nullptr || st->handshake_done)
+    return BIO_do_handshake(bio);
+  uint64_t start = now_ns();
+  if (st->handshake_start_ns == 0)
+    st->handshake_start_ns = start;
+  long r = BIO_do_handshake(bio);
+  uint64_t stop = now_ns();
+  st->handshake_cpu_ns += stop - start;
+  if (r == 1)
+  {
+    st->handshake_done = true;
+    uint64_t total = stop - st->handshake_start_ns;
+    count(&st->metrics, METRIC_HANDSHAKES);
+    if (SSL_session_reused(ssl))
+      count(&st->metrics, METRIC_HANDSHAKES_RESUMED);
+    count(&st->metrics, METRIC_HANDSHAKE_CPU_NS, st->handshake_cpu_ns);
+    count(&st->metrics, METRIC_HANDSHAKE_WAIT_NS, total - st->handshake_cpu_ns);
+    size_t bucket = 0;
+    for (uint64_t us = total / 1000; us != 0 && bucket + 1 < HANDSHAKE_HISTOGRAM_BUCKETS; us >>= 1)
+      bucket++;
+    handshake_histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+  }
+  return r;
+}
+
+static BIO * new_ssl_bio(SSL_CTX * ctx, int client)
+{
+  BIO * b = BIO_new_ssl(ctx, client);
+  if (b == nullptr)
+    return nullptr;
+  SSL * ssl = nullptr;
+  BIO_get_ssl(b, &ssl);
+  // retried writes may come from a different buffer with the same contents, see `bio_write_many`
+  SSL_set_mode(ssl, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+  ConnState * st = get_conn_state(ssl, true);
+  if (auto dynamic = static_cast<DynamicRecords *>(SSL_CTX_get_ex_data(ctx, dynamic_records_index())))
+    st->dynamic = *dynamic;
+  SSL_set_msg_callback(ssl, record_msg_cb);
+  return b;
+}
+
+// @& SSLContext -> Int32 -> IO BIO
+// `SSL_new` takes its own reference on the context, so a context shared by many
+// connections stays alive until both the Lean object and the last `SSL` are freed.
+extern "C" lean_obj_res bio_ssl(b_lean_obj_arg ctx, int client)
+{
+  SSL_FALLIBLE_NULL_ON_ERROR_IO_EC(new_ssl_bio(unwrapEC<SSL_CTX *>(ctx), client));
+}
+
+// Invoked for TLS 1.2 sessions after the handshake and for every TLS 1.3 ticket.
+// Returning 1 means we took ownership of `sess`.
+static int new_session_cb(SSL * ssl, SSL_SESSION * sess)
+{
+  ConnState * st = get_conn_state(ssl, false);
+  if (st == nullptr || !st->session_cache || !SSL_SESSION_is_resumable(sess))
+    return 0;
+  st->session_cache->put(st->session_key, sess);
+  return 1;
+}
+
+// USize -> IO SessionCache
+extern "C" lean_obj_res ssl_session_cache_new(size_t capacity)
+{
+  auto cache = new std::shared_ptr<SessionCache>(std::make_shared<SessionCache>(capacity));
+  return lean_io_result_mk_ok(wrapEC(cache));
+}
+
+// @& SessionCache -> BaseIO USize
+extern "C" size_t ssl_session_cache_size(b_lean_obj_arg cache)
+{
+  return (*unwrapEC<std::shared_ptr<SessionCache> *>(cache))->size();
+}
+
+// @& SSLContext -> BaseIO Unit
+extern "C" lean_obj_res ssl_ctx_enable_client_session_cache(b_lean_obj_arg ctx)
+{
+  SSL_CTX * ctx_ = unwrapEC<SSL_CTX *>(ctx);
+  // sessions are kept in our own `SessionCache`, not in the context
+  SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb(ctx_, new_session_cb);
+  return lean_box(0);
+}
+
+// @& BIO -> @& SessionCache -> @& String -> IO Unit
+extern "C" lean_obj_res bio_set_session_cache(b_lean_obj_arg bio, b_lean_obj_arg cache, b_lean_obj_arg key)
+{
+  SSL * ssl = get_ssl(unwrapEC<BIO *>(bio));
+  if (ssl == nullptr) {
+    return lean_io_result_mk_error(lean_mk_io_user_error(lean_mk_string("bio_set_session_cache: no SSL object found in BIO chain")));
+  }
+  ConnState * st = get_conn_state(ssl, true);
+  st->session_cache = *unwrapEC<std::shared_ptr<SessionCache> *>(cache);
+  st->session_key = std::string(lean_string_cstr(key), lean_string_size(key) - 1);
+  SSL_SESSION * sess = st->session_cache->take(st->session_key);
+  if (sess != nullptr) {
+    ERR_clear_error();
+    int ok = SSL_set_session(ssl, sess);
+    SSL_SESSION_free(sess); // `SSL_set_session` holds its own reference
+    if (!ok) {
+      return lean_io_result_mk_error(error_to_io_user_error());
+    }
+  }
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// @& BIO -> BaseIO Bool
+extern "C" uint8_t bio_session_reused(b_lean_obj_arg bio)
+{
+  SSL * ssl = get_ssl(unwrapEC<BIO *>(bio));
+  if (ssl == nullptr)
+    return 0;
+  return !!SSL_session_reused(ssl);
+}
+
+// Contract: BIOs must set exactly one retry flag among read/write/io_special.
+lean_obj_res handle_retry_error(BIO * bio) {
+  if (!BIO_should_retry(bio)) {
+    std::string err_res = get_all_error();
+    lean_obj_res err = lean_mk_string_from_bytes(err_res.c_str(), err_res.size());
+    return lean_io_result_mk_error(lean_mk_io_user_error(err));
+  }
+  if (BIO_should_read(bio)) {
+    count(conn_metrics(bio), METRIC_RETRY_READ);
+    return lean_io_result_mk_error(lean_mk_io_error_resource_exhausted(EAGAIN, lean_mk_string("SHOULD_READ")));
+  }
+  if (BIO_should_write(bio)) {
+    count(conn_metrics(bio), METRIC_RETRY_WRITE);
+    return lean_io_result_mk_error(lean_mk_io_error_resource_exhausted(EAGAIN, lean_mk_string("SHOULD_WRITE")));
+  }
+  if (BIO_should_io_special(bio)) {
+    count(conn_metrics(bio), METRIC_RETRY_IO_SPECIAL);
+    return lean_io_result_mk_error(lean_mk_io_error_resource_exhausted(EAGAIN, lean_mk_string("SHOULD_IO_SPECIAL")));
+  }
+  lean_panic("handle_retry_error: BIO_should_retry returns true with no retry flag set.", true);
+  return lean_io_result_mk_error(lean_mk_io_user_error(lean_mk_string("handle_retry_error: BIO_should_retry returns true with no retry flag set.")));
+}
+
+// @& BIO -> USize -> IO ByteArray
+extern "C" lean_obj_res bio_read(b_lean_obj_arg bio, size_t len)
+{
+  auto bio_ = unwrapEC<BIO *>(bio);
+  count(conn_metrics(bio_), METRIC_BUFFER_BYTES_ALLOCATED, len);
+  auto arr = lean_alloc_sarray(1, 0, len); // ByteArray
+  size_t read_bytes = 0;
+  ERR_clear_error();
+  if (!BIO_read_ex(bio_, lean_sarray_cptr(arr), len, &read_bytes))
+  {
+    lean_dec(arr);
+    return handle_retry_error(bio_);
+  }
+  lean_sarray_set_size(arr, read_bytes);
+  return lean_io_result_mk_ok(arr);
+}
+
+// @& BIO -> ByteArray -> IO Unit
+extern "C" lean_obj_res bio_write(b_lean_obj_arg bio, lean_obj_arg bs)
+{
+  auto bio_ = unwrapEC<BIO *>(bio);
+  size_t written = 0;
+  ERR_clear_error();
+  if (!BIO_write_ex(bio_, lean_sarray_cptr(bs), lean_sarray_size(bs), &written))
+  {
+    lean_dec(bs);
+    return handle_retry_error(bio_);
+  }
+  lean_dec(bs);
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// @& BIO -> IO Unit
+extern "C" lean_obj_res bio_flush(b_lean_obj_arg bio)
+{
+  auto bio_ = unwrapEC<BIO *>(bio);
+  ERR_clear_error();
+  if (BIO_flush(bio_) != 1)
+  {
+    return handle_retry_error(bio_);
+  }
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// Mirrors `BIO.Status` in FFI.lean. Nullary constructors are boxed scalars and allocate nothing.
+enum BioStatus : unsigned
+{
+  BIO_STATUS_OK = 0,
+  BIO_STATUS_WANT_READ = 1,
+  BIO_STATUS_WANT_WRITE = 2,
+  BIO_STATUS_WANT_IO_SPECIAL = 3,
+  BIO_STATUS_CLOSED = 4,
+  BIO_STATUS_ERROR = 5,
+};
+
+static lean_obj_res mk_status_ok(lean_obj_arg value)
+{
+  lean_obj_res r = lean_alloc_ctor(BIO_STATUS_OK, 1, 0);
+  lean_ctor_set(r, 0, value);
+  return r;
+}
+
+// Errors left behind by unrelated calls would be misattributed to the next failure.
+// Peeking is cheaper than clearing unconditionally, and the queue is empty in the common case.
+static inline void clear_stale_errors()
+{
+  if (ERR_peek_error() != 0)
+    ERR_clear_error();
+}
+
+// The status of a failed BIO operation. Same contract as `handle_retry_error`.
+static lean_obj_res mk_status_failure(BIO * bio)
+{
+  if (!BIO_should_retry(bio)) {
+    if (ERR_peek_error() == 0)
+      return lean_box(BIO_STATUS_CLOSED);
+    std::string err_res = get_all_error();
+    lean_obj_res err = lean_mk_string_from_bytes(err_res.c_str(), err_res.size());
+    lean_obj_res r = lean_alloc_ctor(BIO_STATUS_ERROR, 1, 0);
+    lean_ctor_set(r, 0, lean_mk_io_user_error(err));
+    return r;
+  }
+  Metrics * metrics = conn_metrics(bio);
+  if (BIO_should_read(bio)) {
+    count(metrics, METRIC_RETRY_READ);
+    return lean_box(BIO_STATUS_WANT_READ);
+  }
+  if (BIO_should_write(bio)) {
+    count(metrics, METRIC_RETRY_WRITE);
+    return lean_box(BIO_STATUS_WANT_WRITE);
+  }
+  count(metrics, METRIC_RETRY_IO_SPECIAL);
+  return lean_box(BIO_STATUS_WANT_IO_SPECIAL);
+}
+
+// @& BIO -> USize -> BaseIO (BIO.Status ByteArray)
+extern "C" lean_obj_res bio_read_status(b_lean_obj_arg bio, size_t len)
+{
+  auto bio_ = unwrapEC<BIO *>(bio);
+  count(conn_metrics(bio_), METRIC_BUFFER_BYTES_ALLOCATED, len);
+  auto arr = lean_alloc_sarray(1, 0, len); // ByteArray
+  size_t read_bytes = 0;
+  clear_stale_errors();
+  if (!BIO_read_ex(bio_, lean_sarray_cptr(arr), len, &read_bytes))
+  {
+    lean_dec(arr);
+    return mk_status_failure(bio_);
+  }
+  lean_sarray_set_size(arr, read_bytes);
+  return mk_status_ok(arr);
+}
+
+// Make room for `extra` bytes after the contents of `arr`, in place when `arr` is exclusive.
+static lean_obj_res byte_array_reserve(Metrics * metrics, lean_obj_arg arr, size_t extra)
+{
+  size_t size = lean_sarray_size(arr);
+  size_t capacity = lean_sarray_capacity(arr);
+  if (lean_is_exclusive(arr) && capacity - size >= extra)
+    return arr;
+  size_t new_capacity = std::max(size + extra, 2 * capacity);
+  count(metrics, METRIC_BUFFER_BYTES_ALLOCATED, new_capacity);
+  lean_obj_res r = lean_alloc_sarray(1, size, new_capacity);
+  memcpy(lean_sarray_cptr(r), lean_sarray_cptr(arr), size);
+  lean_dec(arr);
+  return r;
+}
+
+// @& BIO -> ByteArray -> USize -> BaseIO (ByteArray × BIO.Status USize)
+extern "C" lean_obj_res bio_read_into(b_lean_obj_arg bio, lean_obj_arg buf, size_t max)
+{
+  auto bio_ = unwrapEC<BIO *>(bio);
+  buf = byte_array_reserve(conn_metrics(bio_), buf, max);
+  size_t size = lean_sarray_size(buf);
+  size_t read_bytes = 0;
+  lean_obj_res status;
+  clear_stale_errors();
+  if (!BIO_read_ex(bio_, lean_sarray_cptr(buf) + size, max, &read_bytes))
+  {
+    status = mk_status_failure(bio_);
+  }
+  else
+  {
+    lean_sarray_set_size(buf, size + read_bytes);
+    status = mk_status_ok(lean_box_usize(read_bytes));
+  }
+  lean_obj_res pair = lean_alloc_ctor(0, 2, 0); // Prod.mk
+  lean_ctor_set(pair, 0, buf);
+  lean_ctor_set(pair, 1, status);
+  return pair;
+}
+
+// Initial buffer size of `bio_read_available` when the BIO cannot tell how much is buffered.
+static const size_t READ_AVAILABLE_INITIAL_SIZE = SSL3_RT_MAX_PLAIN_LENGTH;
+
+// @& BIO -> USize -> BaseIO (BIO.Status ByteArray)
+// Only the first read may block. Afterwards, reading goes on as long as the chain reports
+// buffered bytes (for SSL: decrypted plaintext, or ciphertext that needs no further `recv`).
+extern "C" lean_obj_res bio_read_available(b_lean_obj_arg bio, size_t max)
+{
+  auto bio_ = unwrapEC<BIO *>(bio);
+  long pending = BIO_pending(bio_);
+  size_t hint = pending > 0 ? (size_t)pending : READ_AVAILABLE_INITIAL_SIZE;
+  Metrics * metrics = conn_metrics(bio_);
+  count(metrics, METRIC_BUFFER_BYTES_ALLOCATED, std::min(max, hint));
+  lean_obj_res arr = lean_alloc_sarray(1, 0, std::min(max, hint)); // ByteArray
+  size_t total = 0;
+  clear_stale_errors();
+  while (total < max)
+  {
+    if (lean_sarray_capacity(arr) == total)
+      arr = byte_array_reserve(metrics, arr, std::min(max - total, total));
+    size_t read_bytes = 0;
+    size_t room = std::min(lean_sarray_capacity(arr), max) - total;
+    if (!BIO_read_ex(bio_, lean_sarray_cptr(arr) + total, room, &read_bytes))
+    {
+      if (total == 0)
+      {
+        lean_dec(arr);
+        return mk_status_failure(bio_);
+      }
+      break; // report what we have, the failure shows up again on the next call
+    }
+    total += read_bytes;
+    lean_sarray_set_size(arr, total);
+    if (BIO_pending(bio_) <= 0)
+      break;
+  }
+  return mk_status_ok(arr);
+}
+
+// @& BIO -> @& ByteArray -> BaseIO (BIO.Status USize)
+// Retries must pass the same `ByteArray` again.
+extern "C" lean_obj_res bio_write_status(b_lean_obj_arg bio, b_lean_obj_arg bs)
+{
+  auto bio_ = unwrapEC<BIO *>(bio);
+  size_t written = 0;
+  clear_stale_errors();
+  if (!write_sized(bio_, lean_sarray_cptr(bs), lean_sarray_size(bs), &written))
+    return mk_status_failure(bio_);
+  return mk_status_ok(lean_box_usize(written));
+}
+
+// Slices are packed into chunks of this size, so that an SSL BIO emits full-size records.
+static const size_t WRITE_MANY_CHUNK_SIZE = SSL3_RT_MAX_PLAIN_LENGTH;
+
+// @& BIO -> @& (Array ByteArray) -> USize -> BaseIO (BIO.Status USize)
+// Writes the concatenation of `parts`, skipping its first `offset` bytes. Returns how many bytes
+// were accepted; a would-block after some progress is reported as `ok`. Chunking only depends on
+// `parts` and `offset`, so resuming at `offset + accepted` retries exactly the same chunk.
+extern "C" lean_obj_res bio_write_many(b_lean_obj_arg bio, b_lean_obj_arg parts, size_t offset)
+{
+  auto bio_ = unwrapEC<BIO *>(bio);
+  thread_local std::vector<unsigned char> staging(WRITE_MANY_CHUNK_SIZE);
+  size_t n_parts = lean_array_size(parts);
+  size_t part = 0;
+  size_t pos = offset; // position inside `parts[part]`
+  while (part < n_parts && pos >= lean_sarray_size(lean_array_get_core(parts, part)))
+  {
+    pos -= lean_sarray_size(lean_array_get_core(parts, part));
+    part++;
+  }
+
+  size_t accepted = 0;
+  clear_stale_errors();
+  while (part < n_parts)
+  {
+    b_lean_obj_arg cur = lean_array_get_core(parts, part);
+    const unsigned char * chunk;
+    size_t chunk_len;
+    if (lean_sarray_size(cur) - pos >= WRITE_MANY_CHUNK_SIZE)
+    {
+      // a full chunk inside one slice is written without copying
+      chunk = lean_sarray_cptr(cur) + pos;
+      chunk_len = WRITE_MANY_CHUNK_SIZE;
+    }
+    else
+    {
+      chunk_len = 0;
+      size_t p = part, q = pos;
+      while (p < n_parts && chunk_len < WRITE_MANY_CHUNK_SIZE)
+      {
+        b_lean_obj_arg slice = lean_array_get_core(parts, p);
+        size_t n = std::min(lean_sarray_size(slice) - q, WRITE_MANY_CHUNK_SIZE - chunk_len);
+        memcpy(staging.data() + chunk_len, lean_sarray_cptr(slice) + q, n);
+        chunk_len += n;
+        q += n;
+        if (q == lean_sarray_size(slice))
+        {
+          p++;
+          q = 0;
+        }
+      }
+      chunk = staging.data();
+    }
+
+    size_t written = 0;
+    if (!write_sized(bio_, chunk, chunk_len, &written))
+    {
+      if (accepted == 0)
+        return mk_status_failure(bio_);
+      break;
+    }
+    accepted += written;
+    pos += written;
+    while (part < n_parts && pos >= lean_sarray_size(lean_array_get_core(parts, part)))
+    {
+      pos -= lean_sarray_size(lean_array_get_core(parts, part));
+      part++;
+    }
+  }
+  return mk_status_ok(lean_box_usize(accepted));
+}
+
+// @& BIO -> BaseIO (BIO.Status Unit)
+extern "C" lean_obj_res bio_flush_status(b_lean_obj_arg bio)
+{
+  auto bio_ = unwrapEC<BIO *>(bio);
+  clear_stale_errors();
+  if (BIO_flush(bio_) != 1)
+    return mk_status_failure(bio_);
+  return mk_status_ok(lean_box(0));
+}
+
+// @& BIO -> BaseIO (BIO.Status Unit)
+extern "C" lean_obj_res bio_handshake_status(b_lean_obj_arg bio)
+{
+  auto bio_ = unwrapEC<BIO *>(bio);
+  clear_stale_errors();
+  if (timed_handshake(bio_) != 1)
+    return mk_status_failure(bio_);
+  return mk_status_ok(lean_box(0));
+}
+
+// A TLS connection without I/O of its own: the SSL BIO sits on one half of a BIO pair
+// and the caller moves ciphertext through the other half, `net`.
+// Both halves are owned here, so neither outlives the other.
+struct TlsEngine
+{
+  BIO * ssl_bio; // SSL BIO -> internal half of the pair
+  BIO * net;
+};
+
+// Buffered ciphertext per direction, before `feed` and the SSL side would-block.
+static const size_t ENGINE_BUFFER_SIZE = 64 * 1024;
+
+static void tls_engine_free(TlsEngine * engine)
+{
+  BIO_free_all(engine->ssl_bio); // stops at the SSL BIO while `engine_bio` handed out references to it
+  BIO_free(engine->net);
+  delete engine;
+}
+
+// @& SSLContext -> Bool -> IO Engine
+extern "C" lean_obj_res engine_new(b_lean_obj_arg ctx, uint8_t client)
+{
+  ERR_clear_error();
+  BIO * ssl_bio = new_ssl_bio(unwrapEC<SSL_CTX *>(ctx), client);
+  BIO * internal = nullptr;
+  BIO * net = nullptr;
+  if (ssl_bio == nullptr || !BIO_new_bio_pair(&internal, ENGINE_BUFFER_SIZE, &net, ENGINE_BUFFER_SIZE)) {
+    BIO_free_all(ssl_bio);
+    return lean_io_result_mk_error(error_to_io_user_error());
+  }
+  // accept plaintext record by record, so that `engine_pump` can drain ciphertext in between
+  SSL_set_mode(get_ssl(ssl_bio), SSL_MODE_ENABLE_PARTIAL_WRITE);
+  BIO_push(ssl_bio, internal);
+  return lean_io_result_mk_ok(wrapEC(new TlsEngine{ssl_bio, net}));
+}
+
+// @& Engine -> BaseIO BIO
+extern "C" lean_obj_res engine_bio(b_lean_obj_arg engine)
+{
+  BIO * b = unwrapEC<TlsEngine *>(engine)->ssl_bio;
+  BIO_up_ref(b);
+  return wrapEC(b);
+}
+
+static size_t engine_feed_bytes(TlsEngine * engine, const unsigned char * data, size_t len)
+{
+  size_t fed = 0;
+  while (fed < len) {
+    size_t n = 0;
+    if (!BIO_write_ex(engine->net, data + fed, len - fed, &n))
+      break; // the pair is full
+    fed += n;
+  }
+  return fed;
+}
+
+// Append at most `max` bytes of outgoing ciphertext to `buf`.
+static lean_obj_res engine_drain_into(TlsEngine * engine, Metrics * metrics, lean_obj_arg buf, size_t max)
+{
+  size_t n = std::min(BIO_ctrl_pending(engine->net), max);
+  if (n == 0)
+    return buf;
+  buf = byte_array_reserve(metrics, buf, n);
+  size_t size = lean_sarray_size(buf);
+  size_t end = size + n;
+  while (size < end) {
+    size_t read_bytes = 0;
+    // the pair is a ring buffer, a read stops at its end
+    if (!BIO_read_ex(engine->net, lean_sarray_cptr(buf) + size, end - size, &read_bytes))
+      break;
+    size += read_bytes;
+  }
+  lean_sarray_set_size(buf, size);
+  return buf;
+}
+
+// @& Engine -> @& ByteArray -> USize -> BaseIO USize
+extern "C" size_t engine_feed(b_lean_obj_arg engine, b_lean_obj_arg bs, size_t offset)
+{
+  size_t size = lean_sarray_size(bs);
+  if (offset >= size)
+    return 0;
+  return engine_feed_bytes(unwrapEC<TlsEngine *>(engine), lean_sarray_cptr(bs) + offset, size - offset);
+}
+
+// @& Engine -> ByteArray -> USize -> BaseIO ByteArray
+extern "C" lean_obj_res engine_drain(b_lean_obj_arg engine, lean_obj_arg buf, size_t max)
+{
+  auto engine_ = unwrapEC<TlsEngine *>(engine);
+  return engine_drain_into(engine_, conn_metrics(engine_->ssl_bio), buf, max);
+}
+
+// @& Engine -> @& ByteArray -> @& ByteArray -> ByteArray -> ByteArray -> BaseIO Engine.Pump
+// Feeds `in`, drives the handshake, encrypts `out` and decrypts everything that arrived, draining the
+// outgoing ciphertext whenever the pair fills up, until none of these makes progress any more.
+extern "C" lean_obj_res engine_pump(b_lean_obj_arg engine, b_lean_obj_arg in, b_lean_obj_arg out,
+                                    lean_obj_arg plaintext, lean_obj_arg ciphertext)
+{
+  auto engine_ = unwrapEC<TlsEngine *>(engine);
+  BIO * bio = engine_->ssl_bio;
+  SSL * ssl = get_ssl(bio);
+  Metrics * metrics = conn_metrics(bio);
+  size_t fed = 0;
+  size_t written = 0;
+  lean_obj_res failure = nullptr; // the first failure other than would-block
+  clear_stale_errors();
+  bool progress = true;
+  while (progress && failure == nullptr) {
+    progress = false;
+    size_t n = engine_feed_bytes(engine_, lean_sarray_cptr(in) + fed, lean_sarray_size(in) - fed);
+    fed += n;
+    progress |= n > 0;
+    if (!SSL_is_init_finished(ssl) && timed_handshake(bio) != 1 && !BIO_should_retry(bio)) {
+      failure = mk_status_failure(bio);
+      break;
+    }
+    if (SSL_is_init_finished(ssl)) {
+      while (written < lean_sarray_size(out)) {
+        size_t w = 0;
+        if (!write_sized(bio, lean_sarray_cptr(out) + written, lean_sarray_size(out) - written, &w)) {
+          if (!BIO_should_retry(bio))
+            failure = mk_status_failure(bio);
+          break;
+        }
+        written += w;
+        progress = true;
+      }
+      while (failure == nullptr) {
+        plaintext = byte_array_reserve(metrics, plaintext, SSL3_RT_MAX_PLAIN_LENGTH);
+        size_t size = lean_sarray_size(plaintext);
+        size_t r = 0;
+        if (!BIO_read_ex(bio, lean_sarray_cptr(plaintext) + size, lean_sarray_capacity(plaintext) - size, &r)) {
+          if (!BIO_should_retry(bio))
+            failure = mk_status_failure(bio);
+          break;
+        }
+        lean_sarray_set_size(plaintext, size + r);
+        progress = true;
+      }
+    }
+    size_t before = lean_sarray_size(ciphertext);
+    ciphertext = engine_drain_into(engine_, metrics, ciphertext, SIZE_MAX);
+    progress |= lean_sarray_size(ciphertext) > before;
+  }
+  lean_obj_res status;
+  if (failure != nullptr)
+    status = failure;
+  else if (!SSL_is_init_finished(ssl))
+    status = lean_box(BIO_STATUS_WANT_READ);
+  else
+    status = mk_status_ok(lean_box(0));
+  lean_obj_res r = lean_alloc_ctor(0, 3, 2 * sizeof(size_t)); // Engine.Pump
+  lean_ctor_set(r, 0, plaintext);
+  lean_ctor_set(r, 1, ciphertext);
+  lean_ctor_set(r, 2, status);
+  lean_ctor_set_usize(r, 3, fed);
+  lean_ctor_set_usize(r, 4, written);
+  return r;
+}
+
+// A bounded pool of threads for CPU-heavy TLS steps (handshakes, large writes), so that a burst of
+// handshakes runs beside the task pool instead of on it. Disabled until configured with workers.
+class CryptoPool
+{
+public:
+  struct Job
+  {
+    BIO * bio;        // holds a reference
+    LeanObjRef data;  // the `ByteArray` to write, unit for a handshake step
+    LeanObjRef done;  // BIO.Status α -> BaseIO Unit, marked MT
+  };
+
+private:
+  std::mutex m_mutex;
+  std::condition_variable m_ready;
+  std::deque<Job> m_queue;
+  // Submitters that found the queue full, woken in order as slots free up, see `await_slot`.
+  std::deque<LeanObjRef> m_slot_waiters;
+  size_t m_reserved = 0; // slots handed to woken waiters that have not submitted yet
+  size_t m_workers = 0;
+  size_t m_capacity = 0;
+  size_t m_write_threshold = SIZE_MAX;
+  size_t m_running = 0;
+
+  static void run_wakes(std::deque<LeanObjRef> & wakes)
+  {
+    for (auto & wake : wakes)
+      lean_dec(lean_apply_1(wake.steal(), lean_io_mk_world()));
+    wakes.clear();
+  }
+
+  static lean_obj_res run(Job & job)
+  {
+    clear_stale_errors();
+    if (job.data.is_unit()) {
+      if (timed_handshake(job.bio) != 1)
+        return mk_status_failure(job.bio);
+      return mk_status_ok(lean_box(0));
+    }
+    size_t written = 0;
+    if (!write_sized(job.bio, lean_sarray_cptr(job.data), lean_sarray_size(job.data), &written))
+      return mk_status_failure(job.bio);
+    return mk_status_ok(lean_box_usize(written));
+  }
+
+  void work()
+  {
+    lean_initialize_thread();
+    while (true)
+    {
+      Job job;
+      std::deque<LeanObjRef> woken;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_ready.wait(lock, [this] { return !m_queue.empty() || m_running > m_workers; });
+        // surplus workers leave once the queue is drained, so a shrunk or disabled pool still finishes its jobs
+        if (m_queue.empty()) {
+          m_running--;
+          break;
+        }
+        job = std::move(m_queue.front());
+        m_queue.pop_front();
+        if (!m_slot_waiters.empty()) {
+          m_reserved++;
+          woken.push_back(std::move(m_slot_waiters.front()));
+          m_slot_waiters.pop_front();
+        }
+      }
+      run_wakes(woken);
+      lean_obj_res status = run(job);
+      BIO_free(job.bio);
+      job.data = LeanObjRef();
+      lean_dec(lean_apply_2(job.done.steal(), status, lean_io_mk_world()));
+    }
+    lean_finalize_thread();
+  }
+
+public:
+  static CryptoPool & get()
+  {
+    static CryptoPool * pool = new CryptoPool(); // never destroyed, the workers run until exit
+    return *pool;
+  }
+
+  // Workers are started lazily and leave once they are more than `workers` and the queue is empty.
+  // Disabling the pool wakes every waiting submitter, which then runs its step inline.
+  // A pool without capacity is disabled: no step could ever be queued, and no waiter ever woken.
+  void configure(size_t workers, size_t capacity, size_t write_threshold)
+  {
+    if (capacity == 0)
+      workers = 0;
+    std::deque<LeanObjRef> woken;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_workers = workers;
+      m_capacity = capacity;
+      m_write_threshold = workers == 0 ? SIZE_MAX : write_threshold;
+      if (workers == 0) {
+        woken.swap(m_slot_waiters);
+        m_reserved = 0;
+      }
+    }
+    m_ready.notify_all();
+    run_wakes(woken);
+  }
+
+  size_t write_threshold()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_write_threshold;
+  }
+
+  bool enabled()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_workers > 0;
+  }
+
+  size_t queued()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_queue.size();
+  }
+
+  // Returns `false` when the queue is full or the pool is disabled; the job is dropped then.
+  // A `reserved` submit uses the slot its `await_slot` was woken for. Others also count reserved slots
+  // and queued waiters as taken, so they cannot overtake anyone already waiting.
+  bool submit(Job && job, bool reserved)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_workers == 0)
+        return false;
+      if (reserved && m_reserved > 0) {
+        m_reserved--;
+      } else if (m_queue.size() + m_reserved >= m_capacity || !m_slot_waiters.empty()) {
+        return false;
+      }
+      for (; m_running < m_workers; m_running++)
+        std::thread([this] { this->work(); }).detach();
+      m_queue.push_back(std::move(job));
+    }
+    m_ready.notify_one();
+    return true;
+  }
+
+  // Run `wake` once a slot is reserved for the caller, or the pool was disabled.
+  // Returns `false` without keeping `wake` if a submit can be retried right away.
+  bool await_slot(LeanObjRef wake)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_workers == 0 || (m_queue.size() + m_reserved < m_capacity && m_slot_waiters.empty()))
+      return false;
+    m_slot_waiters.push_back(std::move(wake));
+    return true;
+  }
+};
+
+// USize -> USize -> USize -> BaseIO Unit
+extern "C" lean_obj_res crypto_pool_configure(size_t workers, size_t capacity, size_t write_threshold)
+{
+  CryptoPool::get().configure(workers, capacity, write_threshold);
+  return lean_box(0);
+}
+
+// BaseIO Bool
+extern "C" uint8_t crypto_pool_enabled()
+{
+  return CryptoPool::get().enabled();
+}
+
+// BaseIO USize
+extern "C" size_t crypto_pool_write_threshold()
+{
+  return CryptoPool::get().write_threshold();
+}
+
+// BaseIO USize
+extern "C" size_t crypto_pool_queued()
+{
+  return CryptoPool::get().queued();
+}
+
+// BaseIO Unit -> BaseIO Bool
+extern "C" uint8_t crypto_pool_await_slot(lean_obj_arg wake)
+{
+  lean_mark_mt(wake);
+  return CryptoPool::get().await_slot(LeanObjRef(wake));
+}
+
+static uint8_t crypto_pool_submit(BIO * bio, LeanObjRef data, bool reserved, lean_obj_arg done)
+{
+  lean_mark_mt(done);
+  if (!data.is_unit())
+    lean_mark_mt(data);
+  BIO_up_ref(bio);
+  if (!CryptoPool::get().submit(CryptoPool::Job{bio, std::move(data), LeanObjRef(done)}, reserved)) {
+    BIO_free(bio);
+    return 0;
+  }
+  return 1;
+}
+
+// @& BIO -> Bool -> (BIO.Status Unit -> BaseIO Unit) -> BaseIO Bool
+extern "C" uint8_t bio_handshake_offload(b_lean_obj_arg bio, uint8_t reserved, lean_obj_arg done)
+{
+  return crypto_pool_submit(unwrapEC<BIO *>(bio), LeanObjRef(), reserved, done);
+}
+
+// @& BIO -> ByteArray -> Bool -> (BIO.Status USize -> BaseIO Unit) -> BaseIO Bool
+extern "C" uint8_t bio_write_offload(b_lean_obj_arg bio, lean_obj_arg data, uint8_t reserved, lean_obj_arg done)
+{
+  return crypto_pool_submit(unwrapEC<BIO *>(bio), LeanObjRef(data), reserved, done);
+}
+
+// @& BIO -> BaseIO Bool
+extern "C" uint8_t bio_should_retry(b_lean_obj_arg bio) {
+  auto bio_ = unwrapEC<BIO *>(bio);
+  uint8_t t = BIO_should_retry(bio_);
+  return !!t; // normalize to {0, 1}, which is Lean 4 `Bool`
+}
+
+// @& BIO -> BaseIO Bool
+extern "C" uint8_t bio_should_write(b_lean_obj_arg bio) {
+  auto bio_ = unwrapEC<BIO *>(bio);
+  uint8_t t = BIO_should_write(bio_);
+  return !!t; // normalize to {0, 1}, which is Lean 4 `Bool`
+}
+
+// @& BIO -> BaseIO Bool
+extern "C" uint8_t bio_should_read(b_lean_obj_arg bio) {
+  auto bio_ = unwrapEC<BIO *>(bio);
+  uint8_t t = BIO_should_read(bio_);
+  return !!t; // normalize to {0, 1}, which is Lean 4 `Bool`
+}
+
+// @& BIO -> BaseIO Bool
+extern "C" uint8_t bio_should_io_special(b_lean_obj_arg bio) {
+  auto bio_ = unwrapEC<BIO *>(bio);
+  uint8_t t = BIO_should_io_special(bio_);
+  return !!t; // normalize to {0, 1}, which is Lean 4 `Bool`
+}
+
+// IO BIO
+extern "C" lean_obj_res bio_mem() {
+  SSL_FALLIBLE_NULL_ON_ERROR_IO_EC(BIO_new(BIO_s_mem()));
+}
+
+// IO BIO
+extern "C" lean_obj_res bio_buffer() {
+  SSL_FALLIBLE_NULL_ON_ERROR_IO_EC(BIO_new(BIO_f_buffer()));
+}
+
+// IO BIO
+extern "C" lean_obj_res bio_base64() {
+  SSL_FALLIBLE_NULL_ON_ERROR_IO_EC(BIO_new(BIO_f_base64()));
+}
+
+static EVP_MD * fetch_md(const char * name);
+static lean_obj_res digest_final(EVP_MD_CTX * ctx);
+
+// @& String -> IO BIO
+extern "C" lean_obj_res bio_md(b_lean_obj_arg name) {
+  ERR_clear_error();
+  EVP_MD * md = fetch_md(lean_string_cstr(name));
+  BIO * b = md == nullptr ? nullptr : BIO_new(BIO_f_md());
+  if (b == nullptr || !BIO_set_md(b, md)) {
+    BIO_free(b);
+    return lean_io_result_mk_error(error_to_io_user_error());
+  }
+  return lean_io_result_mk_ok(wrapEC<BIO *>(b));
+}
+
+// @& BIO -> IO ByteArray
+// Finishes the digest of the first message digest BIO in the chain, which then starts over.
+extern "C" lean_obj_res bio_md_final(b_lean_obj_arg bio) {
+  BIO * md = BIO_find_type(unwrapEC<BIO *>(bio), BIO_TYPE_MD);
+  EVP_MD_CTX * ctx = nullptr;
+  if (md == nullptr || !BIO_get_md_ctx(md, &ctx))
+    return lean_io_result_mk_error(lean_mk_io_user_error(lean_mk_string("bio_md_final: no message digest BIO found in BIO chain")));
+  return digest_final(ctx);
+}
+
+// @& SSLContext -> String -> IO Unit
+extern "C" lean_obj_res ssl_ctx_load_verify_file(b_lean_obj_arg ctx, lean_obj_arg path) {
+  SSL_CTX * ctx_ = unwrapEC<SSL_CTX *>(ctx);
+  ERR_clear_error();
+  if (!SSL_CTX_load_verify_file(ctx_, lean_string_cstr(path))) {
+    lean_dec(path);
+    return lean_io_result_mk_error(error_to_io_user_error());
+  }
+  lean_dec(path);
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// @& SSLContext -> IO Unit
+extern "C" lean_obj_res ssl_ctx_set_default_verify_paths(b_lean_obj_arg ctx) {
+  SSL_CTX * ctx_ = unwrapEC<SSL_CTX *>(ctx);
+  ERR_clear_error();
+  if (!SSL_CTX_set_default_verify_paths(ctx_)) {
+    return lean_io_result_mk_error(error_to_io_user_error());
+  }
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// A fresh `X509_STORE` filled by `load`. The store is never modified afterwards, except for the certificates
+// a hashed directory lookup caches, which OpenSSL guards with the store's own lock.
+template <typename Load>
+static lean_obj_res mk_trust_store(Load load)
+{
+  ERR_clear_error();
+  X509_STORE * store = X509_STORE_new();
+  if (store == nullptr)
+    return lean_io_result_mk_error(error_to_io_user_error());
+  if (!load(store)) {
+    X509_STORE_free(store);
+    return lean_io_result_mk_error(error_to_io_user_error());
+  }
+  return lean_io_result_mk_ok(wrapEC(store));
+}
+
+// @& String -> IO TrustStore
+extern "C" lean_obj_res x509_trust_store_load_file(b_lean_obj_arg path) {
+  return mk_trust_store([&](X509_STORE * store) { return X509_STORE_load_file(store, lean_string_cstr(path)); });
+}
+
+// @& String -> IO TrustStore
+extern "C" lean_obj_res x509_trust_store_load_dir(b_lean_obj_arg path) {
+  return mk_trust_store([&](X509_STORE * store) { return X509_STORE_load_path(store, lean_string_cstr(path)); });
+}
+
+// IO TrustStore
+extern "C" lean_obj_res x509_trust_store_system() {
+  return mk_trust_store([](X509_STORE * store) { return X509_STORE_set_default_paths(store); });
+}
+
+// @& SSLContext -> @& TrustStore -> BaseIO Unit
+extern "C" lean_obj_res ssl_ctx_set_trust_store(b_lean_obj_arg ctx, b_lean_obj_arg store) {
+  // takes its own reference, the store outlives whichever of the Lean object and the contexts goes last
+  SSL_CTX_set1_cert_store(unwrapEC<SSL_CTX *>(ctx), unwrapEC<X509_STORE *>(store));
+  return lean_box(0);
+}
+
+// @& SSLContext -> @& ByteArray -> IO Unit
+extern "C" lean_obj_res ssl_ctx_set_alpn_wire(b_lean_obj_arg ctx, b_lean_obj_arg wire) {
+  SSL_CTX * ctx_ = unwrapEC<SSL_CTX *>(ctx);
+  ERR_clear_error();
+  if (SSL_CTX_set_alpn_protos(ctx_, lean_sarray_cptr(wire), static_cast<unsigned int>(lean_sarray_size(wire))) != 0) {
+    return lean_io_result_mk_error(error_to_io_user_error());
+  }
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// @& SSLContext -> String -> IO Unit
+extern "C" lean_obj_res ssl_ctx_set_cipher_list(b_lean_obj_arg ctx, lean_obj_arg ciphers) {
+  SSL_CTX * ctx_ = unwrapEC<SSL_CTX *>(ctx);
+  ERR_clear_error();
+  if (!SSL_CTX_set_cipher_list(ctx_, lean_string_cstr(ciphers))) {
+    lean_dec(ciphers);
+    return lean_io_result_mk_error(error_to_io_user_error());
+  }
+  lean_dec(ciphers);
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// @& SSLContext -> String -> IO Unit
+extern "C" lean_obj_res ssl_ctx_set_ciphersuites(b_lean_obj_arg ctx, lean_obj_arg suites) {
+  SSL_CTX * ctx_ = unwrapEC<SSL_CTX *>(ctx);
+  ERR_clear_error();
+  if (!SSL_CTX_set_ciphersuites(ctx_, lean_string_cstr(suites))) {
+    lean_dec(suites);
+    return lean_io_result_mk_error(error_to_io_user_error());
+  }
+  lean_dec(suites);
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// @& SSLContext -> String -> IO Unit
+extern "C" lean_obj_res ssl_ctx_set_sigalgs(b_lean_obj_arg ctx, lean_obj_arg sigalgs) {
+  SSL_CTX * ctx_ = unwrapEC<SSL_CTX *>(ctx);
+  ERR_clear_error();
+  if (!SSL_CTX_set1_sigalgs_list(ctx_, lean_string_cstr(sigalgs))) {
+    lean_dec(sigalgs);
+    return lean_io_result_mk_error(error_to_io_user_error());
+  }
+  lean_dec(sigalgs);
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// @& SSLContext -> String -> IO Unit
+extern "C" lean_obj_res ssl_ctx_set_groups(b_lean_obj_arg ctx, lean_obj_arg groups) {
+  SSL_CTX * ctx_ = unwrapEC<SSL_CTX *>(ctx);
+  ERR_clear_error();
+  if (!SSL_CTX_set1_groups_list(ctx_, lean_string_cstr(groups))) {
+    lean_dec(groups);
+    return lean_io_result_mk_error(error_to_io_user_error());
+  }
+  lean_dec(groups);
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// @& SSLContext -> UInt16 -> UInt16 -> IO Unit
+// Wire versions, e.g. 0x0304 for TLS 1.3. 0 leaves the bound at the lowest/highest version OpenSSL supports.
+extern "C" lean_obj_res ssl_ctx_set_proto_versions(b_lean_obj_arg ctx, uint16_t min, uint16_t max) {
+  SSL_CTX * ctx_ = unwrapEC<SSL_CTX *>(ctx);
+  ERR_clear_error();
+  if (!SSL_CTX_set_min_proto_version(ctx_, min) || !SSL_CTX_set_max_proto_version(ctx_, max))
+    return lean_io_result_mk_error(error_to_io_user_error());
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// @& SSLContext -> Bool -> BaseIO Unit
+// Server side: choose by the server's cipher order rather than the client's.
+// With `prioritize_chacha`, ChaCha20-Poly1305 still wins for clients that list it first,
+// which are typically those without AES instructions.
+extern "C" lean_obj_res ssl_ctx_set_server_cipher_preference(b_lean_obj_arg ctx, uint8_t prioritize_chacha) {
+  SSL_CTX * ctx_ = unwrapEC<SSL_CTX *>(ctx);
+  SSL_CTX_set_options(ctx_, SSL_OP_CIPHER_SERVER_PREFERENCE);
+  if (prioritize_chacha)
+    SSL_CTX_set_options(ctx_, SSL_OP_PRIORITIZE_CHACHA);
+  else
+    SSL_CTX_clear_options(ctx_, SSL_OP_PRIORITIZE_CHACHA);
+  return lean_box(0);
+}
+
+// BaseIO Bool
+// AES and carry-less multiplication instructions, which OpenSSL's AES-GCM relies on.
+// Every CPU with VAES has AES-NI as well.
+extern "C" uint8_t crypto_has_aes_hardware() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul");
+#elif defined(__aarch64__) && defined(__linux__)
+  return (getauxval(AT_HWCAP) & HWCAP_AES) && (getauxval(AT_HWCAP) & HWCAP_PMULL);
+#elif defined(__aarch64__) && defined(__APPLE__)
+  return 1; // every Apple silicon CPU has the ARMv8 crypto extension
+#else
+  return 0;
+#endif
+}
+
+// @& SSLContext -> @& String -> IO Unit
+// Generates a P-256 key and a self-signed certificate for `common_name`, valid for one day.
+extern "C" lean_obj_res ssl_ctx_use_self_signed(b_lean_obj_arg ctx, b_lean_obj_arg common_name) {
+  SSL_CTX * ctx_ = unwrapEC<SSL_CTX *>(ctx);
+  ERR_clear_error();
+  EVP_PKEY * pkey = EVP_EC_gen("P-256");
+  X509 * cert = X509_new();
+  bool ok = pkey != nullptr && cert != nullptr
+    && X509_set_version(cert, 2)
+    && ASN1_INTEGER_set(X509_get_serialNumber(cert), 1)
+    && X509_gmtime_adj(X509_getm_notBefore(cert), 0)
+    && X509_gmtime_adj(X509_getm_notAfter(cert), 24 * 3600)
+    && X509_set_pubkey(cert, pkey)
+    && X509_NAME_add_entry_by_txt(X509_get_subject_name(cert), "CN", MBSTRING_UTF8,
+                                  (const unsigned char *)lean_string_cstr(common_name), -1, -1, 0)
+    && X509_set_issuer_name(cert, X509_get_subject_name(cert))
+    && X509_sign(cert, pkey, EVP_sha256()) > 0
+    && SSL_CTX_use_certificate(ctx_, cert) == 1
+    && SSL_CTX_use_PrivateKey(ctx_, pkey) == 1;
+  X509_free(cert);
+  EVP_PKEY_free(pkey);
+  if (!ok) {
+    return lean_io_result_mk_error(error_to_io_user_error());
+  }
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+static void free_string_ex_data(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp)
+{
+  delete static_cast<std::string *>(ptr);
+}
+
+// The ALPN wire list a server context selects from, in order of preference.
+static int alpn_select_index()
+{
+  static int idx = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, free_string_ex_data);
+  return idx;
+}
+
+static int alpn_select_cb(SSL *ssl, const unsigned char **out, unsigned char *outlen,
+                          const unsigned char *in, unsigned int inlen, void *arg)
+{
+  auto wire = static_cast<std::string *>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), alpn_select_index()));
+  if (wire == nullptr)
+    return SSL_TLSEXT_ERR_NOACK;
+  unsigned char *selected = nullptr;
+  unsigned char selected_len = 0;
+  if (SSL_select_next_proto(&selected, &selected_len, (const unsigned char *)wire->data(),
+                            (unsigned int)wire->size(), in, inlen) != OPENSSL_NPN_NEGOTIATED)
+    return SSL_TLSEXT_ERR_NOACK;
+  *out = selected;
+  *outlen = selected_len;
+  return SSL_TLSEXT_ERR_OK;
+}
+
+// @& SSLContext -> @& ByteArray -> IO Unit
+extern "C" lean_obj_res ssl_ctx_set_alpn_select_wire(b_lean_obj_arg ctx, b_lean_obj_arg wire) {
+  SSL_CTX * ctx_ = unwrapEC<SSL_CTX *>(ctx);
+  auto copy = new std::string((const char *)lean_sarray_cptr(wire), lean_sarray_size(wire));
+  delete static_cast<std::string *>(SSL_CTX_get_ex_data(ctx_, alpn_select_index()));
+  ERR_clear_error();
+  if (!SSL_CTX_set_ex_data(ctx_, alpn_select_index(), copy)) {
+    delete copy;
+    return lean_io_result_mk_error(error_to_io_user_error());
+  }
+  SSL_CTX_set_alpn_select_cb(ctx_, alpn_select_cb, nullptr);
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// @& SSLContext -> @& String -> IO Unit
+// The leaf certificate followed by its intermediates, in PEM.
+extern "C" lean_obj_res ssl_ctx_use_certificate_chain_file(b_lean_obj_arg ctx, b_lean_obj_arg path) {
+  SSL_CTX * ctx_ = unwrapEC<SSL_CTX *>(ctx);
+  ERR_clear_error();
+  if (SSL_CTX_use_certificate_chain_file(ctx_, lean_string_cstr(path)) != 1) {
+    return lean_io_result_mk_error(error_to_io_user_error());
+  }
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// @& SSLContext -> @& String -> IO Unit
+// Must come after the certificate, which it is checked against.
+extern "C" lean_obj_res ssl_ctx_use_private_key_file(b_lean_obj_arg ctx, b_lean_obj_arg path) {
+  SSL_CTX * ctx_ = unwrapEC<SSL_CTX *>(ctx);
+  ERR_clear_error();
+  if (SSL_CTX_use_PrivateKey_file(ctx_, lean_string_cstr(path), SSL_FILETYPE_PEM) != 1
+      || SSL_CTX_check_private_key(ctx_) != 1) {
+    return lean_io_result_mk_error(error_to_io_user_error());
+  }
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// Contexts selected by server name, owned by the default context as ex_data.
+// Names are lowercase, `*.example.com` covers exactly one more label.
+struct SniMap
+{
+  std::shared_mutex mutex;
+  std::unordered_map<std::string, SSL_CTX *> contexts; // each holds a reference
+
+  ~SniMap()
+  {
+    for (auto & entry : contexts)
+      SSL_CTX_free(entry.second);
+  }
+
+  // Switch `ssl` to the context for `name`. Returns whether there was one.
+  bool select(SSL * ssl, const char * name)
+  {
+    std::string key(name);
+    std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    std::shared_lock lock(mutex); // held until `SSL_set_SSL_CTX` took its own reference
+    auto it = contexts.find(key);
+    if (it == contexts.end())
+    {
+      size_t dot = key.find('.');
+      if (dot == std::string::npos)
+        return false;
+      it = contexts.find("*" + key.substr(dot));
+      if (it == contexts.end())
+        return false;
+    }
+    return SSL_set_SSL_CTX(ssl, it->second) != nullptr;
+  }
+};
+
+static void sni_map_free(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp)
+{
+  delete static_cast<SniMap *>(ptr);
+}
+
+static int sni_map_index()
+{
+  static int idx = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, sni_map_free);
+  return idx;
+}
+
+// Unknown names keep the default context.
+static int servername_cb(SSL * ssl, int * alert, void * arg)
+{
+  const char * name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+  if (name == nullptr)
+    return SSL_TLSEXT_ERR_NOACK;
+  static_cast<SniMap *>(arg)->select(ssl, name);
+  return SSL_TLSEXT_ERR_OK;
+}
+
+// @& SSLContext -> @& String -> @& SSLContext -> IO Unit
+// Names may be added or replaced while serving, but the first one must be added before.
+extern "C" lean_obj_res ssl_ctx_add_sni_context(b_lean_obj_arg ctx, b_lean_obj_arg name, b_lean_obj_arg sni_ctx) {
+  SSL_CTX * ctx_ = unwrapEC<SSL_CTX *>(ctx);
+  auto map = static_cast<SniMap *>(SSL_CTX_get_ex_data(ctx_, sni_map_index()));
+  if (map == nullptr) {
+    map = new SniMap();
+    ERR_clear_error();
+    if (!SSL_CTX_set_ex_data(ctx_, sni_map_index(), map)) {
+      delete map;
+      return lean_io_result_mk_error(error_to_io_user_error());
+    }
+    SSL_CTX_set_tlsext_servername_callback(ctx_, servername_cb);
+    SSL_CTX_set_tlsext_servername_arg(ctx_, map);
+  }
+  std::string key(lean_string_cstr(name), lean_string_size(name) - 1);
+  std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+  SSL_CTX * target = unwrapEC<SSL_CTX *>(sni_ctx);
+  SSL_CTX_up_ref(target);
+  std::unique_lock lock(map->mutex);
+  auto [it, inserted] = map->contexts.try_emplace(std::move(key), target);
+  if (!inserted) {
+    SSL_CTX_free(it->second);
+    it->second = target;
+  }
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// @& BIO -> IO Unit
+// Must be set before the handshake. OpenSSL falls back to user space by itself when the
+// transport is not a socket, the kernel lacks the `tls` module, or the cipher is not supported.
+extern "C" lean_obj_res bio_enable_ktls(b_lean_obj_arg bio) {
+  SSL * ssl = get_ssl(unwrapEC<BIO *>(bio));
+  if (ssl == nullptr) {
+    return lean_io_result_mk_error(lean_mk_io_user_error(lean_mk_string("bio_enable_ktls: no SSL object found in BIO chain")));
+  }
+  SSL_set_options(ssl, SSL_OP_ENABLE_KTLS);
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// @& BIO -> BaseIO Bool
+extern "C" uint8_t bio_ktls_send(b_lean_obj_arg bio) {
+  SSL * ssl = get_ssl(unwrapEC<BIO *>(bio));
+  return ssl != nullptr && SSL_get_wbio(ssl) != nullptr && BIO_get_ktls_send(SSL_get_wbio(ssl));
+}
+
+// @& BIO -> BaseIO Bool
+extern "C" uint8_t bio_ktls_recv(b_lean_obj_arg bio) {
+  SSL * ssl = get_ssl(unwrapEC<BIO *>(bio));
+  return ssl != nullptr && SSL_get_rbio(ssl) != nullptr && BIO_get_ktls_recv(SSL_get_rbio(ssl));
+}
+
+static lean_obj_res mk_status_error(const std::string & msg)
+{
+  lean_obj_res r = lean_alloc_ctor(BIO_STATUS_ERROR, 1, 0);
+  lean_ctor_set(r, 0, lean_mk_io_user_error(lean_mk_string_from_bytes(msg.c_str(), msg.size())));
+  return r;
+}
+
+// The status of a failed `SSL_*` call that reports through `SSL_get_error` rather than the BIO retry flags.
+static lean_obj_res mk_ssl_status_failure(int ssl_error, const char * what)
+{
+  switch (ssl_error) {
+  case SSL_ERROR_WANT_WRITE:
+    return lean_box(BIO_STATUS_WANT_WRITE);
+  case SSL_ERROR_WANT_READ:
+    return lean_box(BIO_STATUS_WANT_READ);
+  case SSL_ERROR_ZERO_RETURN:
+    return lean_box(BIO_STATUS_CLOSED);
+  default: {
+    std::string err_res = get_all_error();
+    return mk_status_error(err_res.empty() ? std::string(what) + " failed" : err_res);
+  }
+  }
+}
+
+// @& String -> UInt64 -> USize -> IO ByteArray
+// At most `max` bytes of the file at `path` from `offset`, empty at the end of the file.
+extern "C" lean_obj_res file_read_range(b_lean_obj_arg path, uint64_t offset, size_t max) {
+  int fd = open(lean_string_cstr(path), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return mk_io_errno_error(lean_string_cstr(path));
+  lean_obj_res arr = lean_alloc_sarray(1, 0, max);
+  size_t got = 0;
+  while (got < max) {
+    ssize_t n = pread(fd, lean_sarray_cptr(arr) + got, max - got, (off_t)(offset + got));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      auto err = mk_io_errno_error(lean_string_cstr(path));
+      close(fd);
+      lean_dec(arr);
+      return err;
+    }
+    if (n == 0)
+      break;
+    got += (size_t)n;
+  }
+  close(fd);
+  lean_sarray_set_size(arr, got);
+  return lean_io_result_mk_ok(arr);
+}
+
+// @& BIO -> @& String -> UInt64 -> USize -> BaseIO (BIO.Status USize)
+// Sends part of a file with kTLS, without copying it through user space. `SSL_sendfile` reports
+// would-block through `SSL_get_error` only, not through the BIO retry flags.
+extern "C" lean_obj_res bio_sendfile(b_lean_obj_arg bio, b_lean_obj_arg path, uint64_t offset, size_t size) {
+  SSL * ssl = get_ssl(unwrapEC<BIO *>(bio));
+  if (ssl == nullptr)
+    return mk_status_error("bio_sendfile: no SSL object found in BIO chain");
+  int fd = open(lean_string_cstr(path), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return mk_status_error(std::string("bio_sendfile: ") + lean_string_cstr(path) + ": " + strerror(errno));
+  clear_stale_errors();
+  // sendfile(2) takes no `MSG_NOSIGNAL`
+  ossl_ssize_t sent = without_sigpipe([&] { return SSL_sendfile(ssl, fd, (off_t)offset, size, 0); });
+  int saved = sent < 0 ? SSL_get_error(ssl, (int)sent) : SSL_ERROR_NONE;
+  close(fd);
+  if (sent >= 0)
+    return mk_status_ok(lean_box_usize((size_t)sent));
+  return mk_ssl_status_failure(saved, "bio_sendfile: SSL_sendfile");
+}
+
+// @& SSLContext -> Bool -> BaseIO Unit
+extern "C" lean_obj_res ssl_ctx_set_low_memory(b_lean_obj_arg ctx, uint8_t enable) {
+  SSL_CTX * ctx_ = unwrapEC<SSL_CTX *>(ctx);
+  if (enable)
+    SSL_CTX_set_mode(ctx_, SSL_MODE_RELEASE_BUFFERS);
+  else
+    SSL_CTX_clear_mode(ctx_, SSL_MODE_RELEASE_BUFFERS);
+  return lean_box(0);
+}
+
+static void set_stream_low_memory(LeanStreamCtx * stream, bool enable)
+{
+  stream->low_memory = enable;
+  if (enable)
+    stream->tx_spare = LeanObjRef();
+}
+
+// A stream transport pushed under an SSL BIO follows the mode of its context.
+static void inherit_low_memory(BIO * chain)
+{
+  SSL * ssl = get_ssl(chain);
+  LeanStreamCtx * stream = find_stream_ctx(chain);
+  if (ssl != nullptr && stream != nullptr && (SSL_get_mode(ssl) & SSL_MODE_RELEASE_BUFFERS))
+    set_stream_low_memory(stream, true);
+}
+
+// @& BIO -> Bool -> BaseIO Unit
+// Enabling also releases the idle buffers right away; OpenSSL keeps its buffers while they hold data.
+extern "C" lean_obj_res bio_set_low_memory(b_lean_obj_arg bio, uint8_t enable) {
+  BIO * bio_ = unwrapEC<BIO *>(bio);
+  if (SSL * ssl = get_ssl(bio_)) {
+    if (enable) {
+      SSL_set_mode(ssl, SSL_MODE_RELEASE_BUFFERS);
+      SSL_free_buffers(ssl);
+    } else {
+      SSL_clear_mode(ssl, SSL_MODE_RELEASE_BUFFERS);
+    }
+  }
+  if (LeanStreamCtx * stream = find_stream_ctx(bio_))
+    set_stream_low_memory(stream, enable);
+  return lean_box(0);
+}
+
+// @& BIO -> BaseIO USize
+extern "C" size_t bio_buffer_bytes(b_lean_obj_arg bio) {
+  LeanStreamCtx * stream = find_stream_ctx(unwrapEC<BIO *>(bio));
+  return stream == nullptr ? 0 : stream->buffer_bytes();
+}
+
+// @& SSLContext -> USize -> IO Unit
+extern "C" lean_obj_res ssl_ctx_set_max_send_fragment(b_lean_obj_arg ctx, size_t len) {
+  ERR_clear_error();
+  if (!SSL_CTX_set_max_send_fragment(unwrapEC<SSL_CTX *>(ctx), len))
+    return lean_io_result_mk_error(error_to_io_user_error());
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// @& SSLContext -> USize -> BaseIO Unit
+// Read as much as fits into a `buffer_len` byte buffer per `recv`, instead of one record header or body at a time.
+extern "C" lean_obj_res ssl_ctx_set_read_ahead(b_lean_obj_arg ctx, size_t buffer_len) {
+  SSL_CTX * ctx_ = unwrapEC<SSL_CTX *>(ctx);
+  SSL_CTX_set_read_ahead(ctx_, buffer_len > 0);
+  if (buffer_len > 0)
+    SSL_CTX_set_default_read_buffer_len(ctx_, buffer_len);
+  return lean_box(0);
+}
+
+// @& SSLContext -> USize -> IO Unit
+extern "C" lean_obj_res ssl_ctx_set_max_pipelines(b_lean_obj_arg ctx, size_t n) {
+  ERR_clear_error();
+  if (!SSL_CTX_set_max_pipelines(unwrapEC<SSL_CTX *>(ctx), n))
+    return lean_io_result_mk_error(error_to_io_user_error());
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// @& SSLContext -> USize -> UInt64 -> UInt32 -> BaseIO Unit
+// The default for connections created afterwards, `small_record` 0 disables it.
+extern "C" lean_obj_res ssl_ctx_set_dynamic_records(b_lean_obj_arg ctx, size_t small_record, uint64_t threshold,
+                                                    uint32_t idle_ms) {
+  SSL_CTX * ctx_ = unwrapEC<SSL_CTX *>(ctx);
+  delete static_cast<DynamicRecords *>(SSL_CTX_get_ex_data(ctx_, dynamic_records_index()));
+  DynamicRecords * dynamic = nullptr;
+  if (small_record > 0)
+    dynamic = new DynamicRecords{small_record, threshold, (uint64_t)idle_ms * 1000000};
+  SSL_CTX_set_ex_data(ctx_, dynamic_records_index(), dynamic);
+  return lean_box(0);
+}
+
+// @& BIO -> USize -> IO Unit
+extern "C" lean_obj_res bio_set_max_send_fragment(b_lean_obj_arg bio, size_t len) {
+  SSL * ssl = get_ssl(unwrapEC<BIO *>(bio));
+  if (ssl == nullptr)
+    return lean_io_result_mk_error(lean_mk_io_user_error(lean_mk_string("bio_set_max_send_fragment: no SSL BIO found in BIO chain")));
+  ERR_clear_error();
+  if (!SSL_set_max_send_fragment(ssl, len))
+    return lean_io_result_mk_error(error_to_io_user_error());
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// @& BIO -> USize -> BaseIO Unit
+extern "C" lean_obj_res bio_set_read_ahead(b_lean_obj_arg bio, size_t buffer_len) {
+  if (SSL * ssl = get_ssl(unwrapEC<BIO *>(bio))) {
+    SSL_set_read_ahead(ssl, buffer_len > 0);
+    if (buffer_len > 0)
+      SSL_set_default_read_buffer_len(ssl, buffer_len);
+  }
+  return lean_box(0);
+}
+
+// @& BIO -> USize -> IO Unit
+extern "C" lean_obj_res bio_set_max_pipelines(b_lean_obj_arg bio, size_t n) {
+  SSL * ssl = get_ssl(unwrapEC<BIO *>(bio));
+  if (ssl == nullptr)
+    return lean_io_result_mk_error(lean_mk_io_user_error(lean_mk_string("bio_set_max_pipelines: no SSL BIO found in BIO chain")));
+  ERR_clear_error();
+  if (!SSL_set_max_pipelines(ssl, n))
+    return lean_io_result_mk_error(error_to_io_user_error());
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// @& BIO -> USize -> UInt64 -> UInt32 -> BaseIO Unit
+extern "C" lean_obj_res bio_set_dynamic_records(b_lean_obj_arg bio, size_t small_record, uint64_t threshold,
+                                                uint32_t idle_ms) {
+  SSL * ssl = get_ssl(unwrapEC<BIO *>(bio));
+  if (ConnState * st = ssl == nullptr ? nullptr : get_conn_state(ssl, false)) {
+    st->dynamic = DynamicRecords{small_record, threshold, (uint64_t)idle_ms * 1000000};
+    st->dynamic_sent = 0;
+  }
+  return lean_box(0);
+}
+
+// @& BIO -> BaseIO Bool
+// Peeks without blocking. A stream transport may be left with a receive in flight, which the next read picks up.
+extern "C" uint8_t bio_idle_check(b_lean_obj_arg bio) {
+  SSL * ssl = get_ssl(unwrapEC<BIO *>(bio));
+  if (ssl == nullptr || SSL_get_shutdown(ssl) != 0)
+    return false;
+  unsigned char byte;
+  size_t n = 0;
+  clear_stale_errors();
+  if (SSL_peek_ex(ssl, &byte, 1, &n))
+    return false; // unread application data, the last exchange was not consumed entirely
+  // also covers a close_notify or a reset that arrived while idle
+  bool idle = SSL_get_error(ssl, 0) == SSL_ERROR_WANT_READ;
+  ERR_clear_error();
+  return idle;
+}
+
+// @& BIO -> BaseIO UInt32
+// How much early data the session set for resumption allows, 0 once the handshake has started.
+extern "C" uint32_t bio_early_data_limit(b_lean_obj_arg bio) {
+  SSL * ssl = get_ssl(unwrapEC<BIO *>(bio));
+  if (ssl == nullptr || !SSL_in_before(ssl))
+    return 0;
+  SSL_SESSION * sess = SSL_get0_session(ssl);
+  return sess == nullptr ? 0 : SSL_SESSION_get_max_early_data(sess);
 }
 
-// @& BIO -> BaseIO Bool
-extern "C" uint8_t bio_should_retry(b_lean_obj_arg bio) {
-  auto bio_ = unwrapEC<BIO *>(bio);
-  uint8_t t = BIO_should_retry(bio_);
-  return !!t; // normalize to {0, 1}, which is Lean 4 `Bool`
+// @& BIO -> @& ByteArray -> BaseIO (BIO.Status USize)
+// Starts the handshake, so the handshake time is counted from here, see `timed_handshake`.
+extern "C" lean_obj_res bio_write_early_data(b_lean_obj_arg bio, b_lean_obj_arg data) {
+  SSL * ssl = get_ssl(unwrapEC<BIO *>(bio));
+  if (ssl == nullptr)
+    return mk_status_error("bio_write_early_data: no SSL object found in BIO chain");
+  ConnState * st = get_conn_state(ssl, false);
+  if (st != nullptr && st->handshake_start_ns == 0)
+    st->handshake_start_ns = now_ns();
+  size_t written = 0;
+  clear_stale_errors();
+  if (SSL_write_early_data(ssl, lean_sarray_cptr(data), lean_sarray_size(data), &written))
+    return mk_status_ok(lean_box_usize(written));
+  return mk_ssl_status_failure(SSL_get_error(ssl, 0), "bio_write_early_data: SSL_write_early_data");
 }
 
-// @& BIO -> BaseIO Bool
-extern "C" uint8_t bio_should_write(b_lean_obj_arg bio) {
-  auto bio_ = unwrapEC<BIO *>(bio);
-  uint8_t t = BIO_should_write(bio_);
-  return !!t; // normalize to {0, 1}, which is Lean 4 `Bool`
+// @& BIO -> BaseIO EarlyDataStatus
+// `EarlyDataStatus` mirrors `SSL_EARLY_DATA_NOT_SENT`, `_REJECTED` and `_ACCEPTED`.
+extern "C" uint8_t bio_early_data_status(b_lean_obj_arg bio) {
+  SSL * ssl = get_ssl(unwrapEC<BIO *>(bio));
+  return ssl == nullptr ? SSL_EARLY_DATA_NOT_SENT : SSL_get_early_data_status(ssl);
 }
 
-// @& BIO -> BaseIO Bool
-extern "C" uint8_t bio_should_read(b_lean_obj_arg bio) {
-  auto bio_ = unwrapEC<BIO *>(bio);
-  uint8_t t = BIO_should_read(bio_);
-  return !!t; // normalize to {0, 1}, which is Lean 4 `Bool`
+static int ticket_keys_index();
+
+// OpenSSL's replay protection looks tickets up in the internal session cache, which shared ticket keys
+// (see `ssl_ctx_set_ticket_keys`) turn off, so it would reject all early data. Only then is it disabled;
+// with the session cache each ticket still admits early data once.
+static void update_anti_replay(SSL_CTX * ctx)
+{
+  if (SSL_CTX_get_max_early_data(ctx) > 0 && SSL_CTX_get_ex_data(ctx, ticket_keys_index()) != nullptr)
+    SSL_CTX_set_options(ctx, SSL_OP_NO_ANTI_REPLAY);
+  else
+    SSL_CTX_clear_options(ctx, SSL_OP_NO_ANTI_REPLAY);
 }
 
-// @& BIO -> BaseIO Bool
-extern "C" uint8_t bio_should_io_special(b_lean_obj_arg bio) {
-  auto bio_ = unwrapEC<BIO *>(bio);
-  uint8_t t = BIO_should_io_special(bio_);
-  return !!t; // normalize to {0, 1}, which is Lean 4 `Bool`
+// @& SSLContext -> UInt32 -> BaseIO Unit
+extern "C" lean_obj_res ssl_ctx_set_max_early_data(b_lean_obj_arg ctx, uint32_t max) {
+  SSL_CTX * ctx_ = unwrapEC<SSL_CTX *>(ctx);
+  SSL_CTX_set_max_early_data(ctx_, max);
+  update_anti_replay(ctx_);
+  return lean_box(0);
 }
 
-// IO BIO
-extern "C" lean_obj_res bio_mem() {
-  SSL_FALLIBLE_NULL_ON_ERROR_IO_EC(BIO_new(BIO_s_mem()));
+// @& BIO -> USize -> BaseIO (BIO.Status ByteArray)
+// `closed` once there is no more early data, right away if the context does not accept any.
+extern "C" lean_obj_res bio_read_early_data(b_lean_obj_arg bio, size_t len) {
+  SSL * ssl = get_ssl(unwrapEC<BIO *>(bio));
+  if (ssl == nullptr || SSL_get_max_early_data(ssl) == 0)
+    return lean_box(BIO_STATUS_CLOSED);
+  lean_obj_res arr = lean_alloc_sarray(1, 0, len); // ByteArray
+  size_t read_bytes = 0;
+  clear_stale_errors();
+  switch (SSL_read_early_data(ssl, lean_sarray_cptr(arr), len, &read_bytes)) {
+  case SSL_READ_EARLY_DATA_SUCCESS:
+    lean_sarray_set_size(arr, read_bytes);
+    return mk_status_ok(arr);
+  case SSL_READ_EARLY_DATA_FINISH:
+    lean_dec(arr);
+    return lean_box(BIO_STATUS_CLOSED);
+  default:
+    lean_dec(arr);
+    return mk_ssl_status_failure(SSL_get_error(ssl, 0), "bio_read_early_data: SSL_read_early_data");
+  }
 }
 
-// IO BIO
-extern "C" lean_obj_res bio_buffer() {
-  SSL_FALLIBLE_NULL_ON_ERROR_IO_EC(BIO_new(BIO_f_buffer()));
+// @& BIO -> BaseIO (Option String)
+extern "C" lean_obj_res bio_server_name(b_lean_obj_arg bio) {
+  SSL * ssl = get_ssl(unwrapEC<BIO *>(bio));
+  if (ssl == nullptr)
+    return lean_box(0); // Option.none
+  const char * name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+  if (name == nullptr)
+    return lean_box(0);
+  lean_obj_res some = lean_alloc_ctor(1, 1, 0);
+  lean_ctor_set(some, 0, lean_mk_string(name));
+  return some;
 }
 
-// IO BIO
-extern "C" lean_obj_res bio_base64() {
-  SSL_FALLIBLE_NULL_ON_ERROR_IO_EC(BIO_new(BIO_f_base64()));
+// IO TicketKeys
+extern "C" lean_obj_res ssl_ticket_keys_new()
+{
+  auto keys = std::make_shared<TicketKeys>();
+  ERR_clear_error();
+  if (!keys->rotate()) {
+    return lean_io_result_mk_error(error_to_io_user_error());
+  }
+  return lean_io_result_mk_ok(wrapEC(new std::shared_ptr<TicketKeys>(std::move(keys))));
 }
 
-// @& SSLContext -> String -> IO Unit
-extern "C" lean_obj_res ssl_ctx_load_verify_file(b_lean_obj_arg ctx, lean_obj_arg path) {
-  SSL_CTX * ctx_ = unwrapEC<SSL_CTX *>(ctx);
+// @& TicketKeys -> IO Unit
+extern "C" lean_obj_res ssl_ticket_keys_rotate(b_lean_obj_arg keys)
+{
   ERR_clear_error();
-  if (!SSL_CTX_load_verify_file(ctx_, lean_string_cstr(path))) {
-    lean_dec(path);
+  if (!(*unwrapEC<std::shared_ptr<TicketKeys> *>(keys))->rotate()) {
     return lean_io_result_mk_error(error_to_io_user_error());
   }
-  lean_dec(path);
   return lean_io_result_mk_ok(lean_box(0));
 }
 
-// @& SSLContext -> IO Unit
-extern "C" lean_obj_res ssl_ctx_set_default_verify_paths(b_lean_obj_arg ctx) {
+static void ticket_keys_free(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp)
+{
+  delete static_cast<std::shared_ptr<TicketKeys> *>(ptr);
+}
+
+static int ticket_keys_index()
+{
+  static int idx = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, ticket_keys_free);
+  return idx;
+}
+
+static int ticket_hmac_init(EVP_MAC_CTX * hctx, const TicketKeys::Key & key)
+{
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, (void *)key.hmac, sizeof(key.hmac)),
+    OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char *)"SHA256", 0),
+    OSSL_PARAM_construct_end(),
+  };
+  return EVP_MAC_CTX_set_params(hctx, params);
+}
+
+// Returns -1 on error, 0 to reject a ticket, 1 to accept, 2 to accept and issue a fresh ticket.
+static int ticket_key_cb(SSL * ssl, unsigned char key_name[16], unsigned char * iv,
+                         EVP_CIPHER_CTX * cctx, EVP_MAC_CTX * hctx, int enc)
+{
+  auto keys = static_cast<std::shared_ptr<TicketKeys> *>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ticket_keys_index()));
+  if (keys == nullptr)
+    return enc ? -1 : 0;
+  TicketKeys::Key key;
+  int r;
+  if (enc) {
+    (*keys)->current(key);
+    memcpy(key_name, key.name, sizeof(key.name));
+    r = RAND_bytes(iv, EVP_MAX_IV_LENGTH) == 1
+      && EVP_EncryptInit_ex(cctx, EVP_aes_256_cbc(), nullptr, key.aes, iv) == 1
+      && ticket_hmac_init(hctx, key) == 1 ? 1 : -1;
+  } else {
+    TicketKeys::Found found = (*keys)->find(key_name, key);
+    if (found == TicketKeys::NOT_FOUND) {
+      r = 0;
+    } else {
+      r = ticket_hmac_init(hctx, key) == 1
+        && EVP_DecryptInit_ex(cctx, EVP_aes_256_cbc(), nullptr, key.aes, iv) == 1
+        ? (found == TicketKeys::CURRENT ? 1 : 2) : -1;
+    }
+  }
+  OPENSSL_cleanse(&key, sizeof(key));
+  return r;
+}
+
+// @& SSLContext -> @& TicketKeys -> IO Unit
+// Resumption becomes stateless: the server-side session cache, and its lock, is turned off.
+extern "C" lean_obj_res ssl_ctx_set_ticket_keys(b_lean_obj_arg ctx, b_lean_obj_arg keys)
+{
   SSL_CTX * ctx_ = unwrapEC<SSL_CTX *>(ctx);
+  auto holder = new std::shared_ptr<TicketKeys>(*unwrapEC<std::shared_ptr<TicketKeys> *>(keys));
+  auto old = static_cast<std::shared_ptr<TicketKeys> *>(SSL_CTX_get_ex_data(ctx_, ticket_keys_index()));
   ERR_clear_error();
-  if (!SSL_CTX_set_default_verify_paths(ctx_)) {
+  if (!SSL_CTX_set_ex_data(ctx_, ticket_keys_index(), holder)) {
+    // the old keys stay in place, and are freed with the context
+    delete holder;
     return lean_io_result_mk_error(error_to_io_user_error());
   }
+  delete old;
+  SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_OFF);
+  SSL_CTX_clear_options(ctx_, SSL_OP_NO_TICKET);
+  SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx_, ticket_key_cb);
+  update_anti_replay(ctx_);
   return lean_io_result_mk_ok(lean_box(0));
 }
 
-// @& SSLContext -> @& ByteArray -> IO Unit
-extern "C" lean_obj_res ssl_ctx_set_alpn_wire(b_lean_obj_arg ctx, b_lean_obj_arg wire) {
-  SSL_CTX * ctx_ = unwrapEC<SSL_CTX *>(ctx);
+// @& SSLContext -> @& SSLContext -> IO Unit
+// Use the certificate, chain and key of `src` without loading or parsing them again;
+// the objects are reference counted and shared.
+extern "C" lean_obj_res ssl_ctx_share_certificate(b_lean_obj_arg dst, b_lean_obj_arg src)
+{
+  SSL_CTX * dst_ = unwrapEC<SSL_CTX *>(dst);
+  SSL_CTX * src_ = unwrapEC<SSL_CTX *>(src);
+  X509 * cert = SSL_CTX_get0_certificate(src_);
+  EVP_PKEY * pkey = SSL_CTX_get0_privatekey(src_);
+  if (cert == nullptr || pkey == nullptr) {
+    return lean_io_result_mk_error(lean_mk_io_user_error(lean_mk_string("ssl_ctx_share_certificate: source context has no certificate")));
+  }
+  STACK_OF(X509) * chain = nullptr;
+  SSL_CTX_get0_chain_certs(src_, &chain);
   ERR_clear_error();
-  if (SSL_CTX_set_alpn_protos(ctx_, lean_sarray_cptr(wire), static_cast<unsigned int>(lean_sarray_size(wire))) != 0) {
+  if (SSL_CTX_use_certificate(dst_, cert) != 1
+      || SSL_CTX_use_PrivateKey(dst_, pkey) != 1
+      || SSL_CTX_set1_chain(dst_, chain) != 1) {
     return lean_io_result_mk_error(error_to_io_user_error());
   }
   return lean_io_result_mk_ok(lean_box(0));
@@ -632,7 +3967,7 @@ extern "C" lean_obj_res ssl_ctx_set_alpn_wire(b_lean_obj_arg ctx, b_lean_obj_arg
 // @& SSLContext -> Int32 -> BaseIO Unit
 extern "C" lean_obj_res ssl_ctx_set_verify(b_lean_obj_arg ctx, int32_t mode) {
   SSL_CTX *ctx_ = unwrapEC<SSL_CTX *>(ctx);
-  SSL_CTX_set_verify(ctx_, SSL_VERIFY_PEER, nullptr);
+  SSL_CTX_set_verify(ctx_, mode, nullptr);
   return lean_box(0);
 }
 
@@ -640,7 +3975,7 @@ extern "C" lean_obj_res ssl_ctx_set_verify(b_lean_obj_arg ctx, int32_t mode) {
 extern "C" lean_obj_res bio_handshake(b_lean_obj_arg bio) {
   BIO * bio_ = unwrapEC<BIO *>(bio);
   ERR_clear_error();
-  if (BIO_do_handshake(bio_) != 1) {
+  if (timed_handshake(bio_) != 1) {
     return handle_retry_error(bio_);
   }
   return lean_io_result_mk_ok(lean_box(0));
@@ -690,3 +4025,455 @@ extern "C" lean_obj_res bio_get_alpn_selected(b_lean_obj_arg bio) {
 }
 
 // Async T = BaseIO (Std.Internal.IO.Async.MaybeTask (Except IO.Error T))
+
+// `Metrics` has only `UInt64` fields, stored as scalars in declaration order.
+static lean_obj_res mk_metrics(uint64_t const (&values)[METRIC_COUNT])
+{
+  lean_object *o = lean_alloc_ctor(0, 0, METRIC_COUNT * sizeof(uint64_t));
+  for (unsigned i = 0; i < METRIC_COUNT; i++)
+    lean_ctor_set_uint64(o, i * sizeof(uint64_t), values[i]);
+  return o;
+}
+
+// BaseIO Metrics
+extern "C" lean_obj_res tls_global_metrics()
+{
+  uint64_t values[METRIC_COUNT];
+  for (unsigned i = 0; i < METRIC_COUNT; i++)
+  {
+    values[i] = 0;
+    for (auto & shard : global_metric_shards)
+      values[i] += shard.metrics.get((Metric)i);
+  }
+  return mk_metrics(values);
+}
+
+// @& BIO -> BaseIO Metrics
+// The counters of the SSL object and of the stream transport in the chain, added up.
+extern "C" lean_obj_res bio_metrics(b_lean_obj_arg bio)
+{
+  BIO * bio_ = unwrapEC<BIO *>(bio);
+  Metrics * conn = conn_metrics(bio_);
+  LeanStreamCtx * stream = find_stream_ctx(bio_);
+  uint64_t values[METRIC_COUNT];
+  for (unsigned i = 0; i < METRIC_COUNT; i++)
+  {
+    values[i] = (conn == nullptr ? 0 : conn->get((Metric)i))
+              + (stream == nullptr ? 0 : stream->metrics.get((Metric)i));
+  }
+  return mk_metrics(values);
+}
+
+// BaseIO (Array UInt64)
+extern "C" lean_obj_res tls_handshake_histogram()
+{
+  lean_object *arr = lean_alloc_array(HANDSHAKE_HISTOGRAM_BUCKETS, HANDSHAKE_HISTOGRAM_BUCKETS);
+  for (size_t i = 0; i < HANDSHAKE_HISTOGRAM_BUCKETS; i++)
+    lean_array_set_core(arr, i, lean_box_uint64(handshake_histogram[i].load(std::memory_order_relaxed)));
+  return arr;
+}
+
+static lean_obj_res mk_option_string(const char * str)
+{
+  if (str == nullptr)
+    return lean_box(0); // Option.none
+  lean_obj_res some = lean_alloc_ctor(1, 1, 0);
+  lean_ctor_set(some, 0, lean_mk_string(str));
+  return some;
+}
+
+// @& BIO -> BaseIO (Option String)
+extern "C" lean_obj_res bio_cipher_name(b_lean_obj_arg bio)
+{
+  SSL * ssl = get_ssl(unwrapEC<BIO *>(bio));
+  if (ssl == nullptr || SSL_get_current_cipher(ssl) == nullptr)
+    return lean_box(0);
+  return mk_option_string(SSL_CIPHER_get_name(SSL_get_current_cipher(ssl)));
+}
+
+// @& BIO -> BaseIO (Option String)
+extern "C" lean_obj_res bio_group_name(b_lean_obj_arg bio)
+{
+  SSL * ssl = get_ssl(unwrapEC<BIO *>(bio));
+  if (ssl == nullptr || !SSL_is_init_finished(ssl))
+    return lean_box(0);
+  const char * name = SSL_group_to_name(ssl, SSL_get_negotiated_group(ssl));
+  return name == nullptr ? lean_box(0) : mk_option_string(name);
+}
+
+// @& BIO -> BaseIO (Option String)
+extern "C" lean_obj_res bio_protocol_version(b_lean_obj_arg bio)
+{
+  SSL * ssl = get_ssl(unwrapEC<BIO *>(bio));
+  if (ssl == nullptr || !SSL_is_init_finished(ssl))
+    return lean_box(0);
+  return mk_option_string(SSL_get_version(ssl));
+}
+
+// Algorithms are fetched from the provider once per name and kept for the life of the process,
+// fetching takes a lock and costs about as much as hashing a short message.
+template <typename T, T * (*Fetch)(OSSL_LIB_CTX *, const char *, const char *), void (*Free)(T *)>
+static T * fetch_cached(const char * name)
+{
+  static std::shared_mutex mutex;
+  static std::unordered_map<std::string, T *> cache;
+  {
+    std::shared_lock lock(mutex);
+    auto it = cache.find(name);
+    if (it != cache.end())
+      return it->second;
+  }
+  T * alg = Fetch(nullptr, name, nullptr);
+  if (alg == nullptr)
+    return nullptr;
+  std::unique_lock lock(mutex);
+  auto [it, inserted] = cache.emplace(name, alg);
+  if (!inserted)
+    Free(alg);
+  return it->second;
+}
+
+static EVP_MD * fetch_md(const char * name) { return fetch_cached<EVP_MD, EVP_MD_fetch, EVP_MD_free>(name); }
+static EVP_MAC * fetch_mac(const char * name) { return fetch_cached<EVP_MAC, EVP_MAC_fetch, EVP_MAC_free>(name); }
+static EVP_CIPHER * fetch_cipher(const char * name)
+{
+  return fetch_cached<EVP_CIPHER, EVP_CIPHER_fetch, EVP_CIPHER_free>(name);
+}
+
+static lean_obj_res mk_byte_array(const unsigned char * data, size_t len)
+{
+  lean_obj_res arr = lean_alloc_sarray(1, len, len);
+  memcpy(lean_sarray_cptr(arr), data, len);
+  return arr;
+}
+
+// The EVP update functions take `int` lengths.
+static const size_t CRYPTO_CHUNK = 1 << 30;
+
+static int digest_update(EVP_MD_CTX * ctx, b_lean_obj_arg data)
+{
+  const unsigned char * p = lean_sarray_cptr(data);
+  size_t len = lean_sarray_size(data);
+  for (size_t off = 0; off < len; off += CRYPTO_CHUNK)
+    if (!EVP_DigestUpdate(ctx, p + off, std::min(CRYPTO_CHUNK, len - off)))
+      return 0;
+  return 1;
+}
+
+// Finish the digest and start over with the same algorithm.
+static lean_obj_res digest_final(EVP_MD_CTX * ctx)
+{
+  unsigned char md[EVP_MAX_MD_SIZE];
+  unsigned int len = 0;
+  ERR_clear_error();
+  if (!EVP_DigestFinal_ex(ctx, md, &len) || !EVP_DigestInit_ex2(ctx, nullptr, nullptr))
+    return lean_io_result_mk_error(error_to_io_user_error());
+  return lean_io_result_mk_ok(mk_byte_array(md, len));
+}
+
+// @& String -> IO Digest
+extern "C" lean_obj_res crypto_digest_new(b_lean_obj_arg name)
+{
+  ERR_clear_error();
+  EVP_MD * md = fetch_md(lean_string_cstr(name));
+  EVP_MD_CTX * ctx = md == nullptr ? nullptr : EVP_MD_CTX_new();
+  if (ctx == nullptr || !EVP_DigestInit_ex2(ctx, md, nullptr)) {
+    EVP_MD_CTX_free(ctx);
+    return lean_io_result_mk_error(error_to_io_user_error());
+  }
+  return lean_io_result_mk_ok(wrapEC<EVP_MD_CTX *>(ctx));
+}
+
+// @& Digest -> @& ByteArray -> IO Unit
+extern "C" lean_obj_res crypto_digest_update(b_lean_obj_arg digest, b_lean_obj_arg data)
+{
+  ERR_clear_error();
+  if (!digest_update(unwrapEC<EVP_MD_CTX *>(digest), data))
+    return lean_io_result_mk_error(error_to_io_user_error());
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// @& Digest -> IO ByteArray
+extern "C" lean_obj_res crypto_digest_final(b_lean_obj_arg digest)
+{
+  return digest_final(unwrapEC<EVP_MD_CTX *>(digest));
+}
+
+// @& Digest -> IO Digest
+extern "C" lean_obj_res crypto_digest_copy(b_lean_obj_arg digest)
+{
+  ERR_clear_error();
+  EVP_MD_CTX * ctx = EVP_MD_CTX_new();
+  if (ctx == nullptr || !EVP_MD_CTX_copy_ex(ctx, unwrapEC<EVP_MD_CTX *>(digest))) {
+    EVP_MD_CTX_free(ctx);
+    return lean_io_result_mk_error(error_to_io_user_error());
+  }
+  return lean_io_result_mk_ok(wrapEC<EVP_MD_CTX *>(ctx));
+}
+
+// @& String -> @& Array ByteArray -> IO (Array ByteArray)
+// One context is reused for every input, so each costs an init, an update and a final, nothing else.
+extern "C" lean_obj_res crypto_hash_many(b_lean_obj_arg name, b_lean_obj_arg inputs)
+{
+  ERR_clear_error();
+  EVP_MD * md = fetch_md(lean_string_cstr(name));
+  std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx(md == nullptr ? nullptr : EVP_MD_CTX_new(),
+                                                              EVP_MD_CTX_free);
+  if (!ctx || !EVP_DigestInit_ex2(ctx.get(), md, nullptr))
+    return lean_io_result_mk_error(error_to_io_user_error());
+  size_t n = lean_array_size(inputs);
+  lean_obj_res out = lean_alloc_array(0, n);
+  for (size_t i = 0; i < n; i++) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+    if (!digest_update(ctx.get(), lean_array_get_core(inputs, i)) || !EVP_DigestFinal_ex(ctx.get(), digest, &len) ||
+        !EVP_DigestInit_ex2(ctx.get(), nullptr, nullptr)) {
+      lean_dec(out);
+      return lean_io_result_mk_error(error_to_io_user_error());
+    }
+    out = lean_array_push(out, mk_byte_array(digest, len));
+  }
+  return lean_io_result_mk_ok(out);
+}
+
+// @& String -> @& ByteArray -> IO Mac
+extern "C" lean_obj_res crypto_hmac_new(b_lean_obj_arg digest, b_lean_obj_arg key)
+{
+  ERR_clear_error();
+  EVP_MAC * mac = fetch_mac("HMAC");
+  EVP_MAC_CTX * ctx = mac == nullptr ? nullptr : EVP_MAC_CTX_new(mac);
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, const_cast<char *>(lean_string_cstr(digest)), 0),
+    OSSL_PARAM_construct_end(),
+  };
+  if (ctx == nullptr || !EVP_MAC_init(ctx, lean_sarray_cptr(key), lean_sarray_size(key), params)) {
+    EVP_MAC_CTX_free(ctx);
+    return lean_io_result_mk_error(error_to_io_user_error());
+  }
+  return lean_io_result_mk_ok(wrapEC<EVP_MAC_CTX *>(ctx));
+}
+
+// @& Mac -> @& ByteArray -> IO Unit
+extern "C" lean_obj_res crypto_mac_update(b_lean_obj_arg mac, b_lean_obj_arg data)
+{
+  ERR_clear_error();
+  if (!EVP_MAC_update(unwrapEC<EVP_MAC_CTX *>(mac), lean_sarray_cptr(data), lean_sarray_size(data)))
+    return lean_io_result_mk_error(error_to_io_user_error());
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// @& Mac -> IO ByteArray
+// Initializing without a key starts over with the key from `crypto_hmac_new`.
+extern "C" lean_obj_res crypto_mac_final(b_lean_obj_arg mac)
+{
+  EVP_MAC_CTX * ctx = unwrapEC<EVP_MAC_CTX *>(mac);
+  unsigned char out[EVP_MAX_MD_SIZE];
+  size_t len = 0;
+  ERR_clear_error();
+  if (!EVP_MAC_final(ctx, out, &len, sizeof(out)) || !EVP_MAC_init(ctx, nullptr, 0, nullptr))
+    return lean_io_result_mk_error(error_to_io_user_error());
+  return lean_io_result_mk_ok(mk_byte_array(out, len));
+}
+
+// @& ByteArray -> @& ByteArray -> Bool
+extern "C" uint8_t crypto_constant_time_eq(b_lean_obj_arg a, b_lean_obj_arg b)
+{
+  size_t len = lean_sarray_size(a);
+  return len == lean_sarray_size(b) && CRYPTO_memcmp(lean_sarray_cptr(a), lean_sarray_cptr(b), len) == 0;
+}
+
+// @& String -> @& ByteArray -> Bool -> IO Aead
+// Only GCM and ChaCha20-Poly1305, whose updates output every byte they are given. CCM needs the message
+// length before the first update, OCB holds back a partial block until the final call, and SIV the whole message.
+extern "C" lean_obj_res crypto_aead_new(b_lean_obj_arg name, b_lean_obj_arg key, uint8_t encrypt)
+{
+  ERR_clear_error();
+  EVP_CIPHER * cipher = fetch_cipher(lean_string_cstr(name));
+  if (cipher == nullptr)
+    return lean_io_result_mk_error(error_to_io_user_error());
+  if (EVP_CIPHER_get_mode(cipher) != EVP_CIPH_GCM_MODE && !EVP_CIPHER_is_a(cipher, "ChaCha20-Poly1305")) {
+    std::string msg = std::string("crypto_aead_new: ") + lean_string_cstr(name) + " is not a streaming AEAD";
+    return lean_io_result_mk_error(lean_mk_io_user_error(lean_mk_string(msg.c_str())));
+  }
+  if (lean_sarray_size(key) != (size_t)EVP_CIPHER_get_key_length(cipher)) {
+    std::string msg = "crypto_aead_new: the key must be " + std::to_string(EVP_CIPHER_get_key_length(cipher)) + " bytes";
+    return lean_io_result_mk_error(lean_mk_io_user_error(lean_mk_string(msg.c_str())));
+  }
+  EVP_CIPHER_CTX * ctx = EVP_CIPHER_CTX_new();
+  if (ctx == nullptr || !EVP_CipherInit_ex2(ctx, cipher, lean_sarray_cptr(key), nullptr, encrypt, nullptr)) {
+    EVP_CIPHER_CTX_free(ctx);
+    return lean_io_result_mk_error(error_to_io_user_error());
+  }
+  return lean_io_result_mk_ok(wrapEC<EVP_CIPHER_CTX *>(ctx));
+}
+
+// @& Aead -> @& ByteArray -> IO Unit
+extern "C" lean_obj_res crypto_aead_start(b_lean_obj_arg aead, b_lean_obj_arg nonce)
+{
+  EVP_CIPHER_CTX * ctx = unwrapEC<EVP_CIPHER_CTX *>(aead);
+  size_t len = lean_sarray_size(nonce);
+  ERR_clear_error();
+  // the IV length has to be set before the IV itself
+  if (len != (size_t)EVP_CIPHER_CTX_get_iv_length(ctx)) {
+    OSSL_PARAM params[] = {
+      OSSL_PARAM_construct_size_t(OSSL_CIPHER_PARAM_AEAD_IVLEN, &len),
+      OSSL_PARAM_construct_end(),
+    };
+    if (!EVP_CIPHER_CTX_set_params(ctx, params))
+      return lean_io_result_mk_error(error_to_io_user_error());
+  }
+  if (!EVP_CipherInit_ex2(ctx, nullptr, nullptr, lean_sarray_cptr(nonce), -1, nullptr))
+    return lean_io_result_mk_error(error_to_io_user_error());
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// Feed `len` bytes to the cipher, writing the output to `out` (`nullptr` for additional data).
+static int cipher_update(EVP_CIPHER_CTX * ctx, unsigned char * out, const unsigned char * in, size_t len, size_t * written)
+{
+  *written = 0;
+  for (size_t off = 0; off < len; off += CRYPTO_CHUNK) {
+    int n = 0;
+    if (!EVP_CipherUpdate(ctx, out == nullptr ? nullptr : out + *written, &n, in + off, (int)std::min(CRYPTO_CHUNK, len - off)))
+      return 0;
+    *written += n;
+  }
+  return 1;
+}
+
+// @& Aead -> @& ByteArray -> IO Unit
+extern "C" lean_obj_res crypto_aead_aad(b_lean_obj_arg aead, b_lean_obj_arg aad)
+{
+  size_t written = 0;
+  ERR_clear_error();
+  if (!cipher_update(unwrapEC<EVP_CIPHER_CTX *>(aead), nullptr, lean_sarray_cptr(aad), lean_sarray_size(aad), &written))
+    return lean_io_result_mk_error(error_to_io_user_error());
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// @& Aead -> @& ByteArray -> ByteArray -> IO ByteArray
+extern "C" lean_obj_res crypto_aead_update(b_lean_obj_arg aead, b_lean_obj_arg input, lean_obj_arg buf)
+{
+  size_t len = lean_sarray_size(input);
+  buf = byte_array_reserve(nullptr, buf, len + EVP_MAX_BLOCK_LENGTH);
+  size_t size = lean_sarray_size(buf);
+  size_t written = 0;
+  ERR_clear_error();
+  if (!cipher_update(unwrapEC<EVP_CIPHER_CTX *>(aead), lean_sarray_cptr(buf) + size, lean_sarray_cptr(input), len, &written)) {
+    lean_dec(buf);
+    return lean_io_result_mk_error(error_to_io_user_error());
+  }
+  lean_sarray_set_size(buf, size + written);
+  return lean_io_result_mk_ok(buf);
+}
+
+// Tags are always full length: OpenSSL would also check a truncated GCM tag, down to a single byte.
+static constexpr size_t AEAD_TAG_LEN = 16;
+
+// @& Aead -> IO ByteArray
+extern "C" lean_obj_res crypto_aead_seal_final(b_lean_obj_arg aead)
+{
+  EVP_CIPHER_CTX * ctx = unwrapEC<EVP_CIPHER_CTX *>(aead);
+  if (!EVP_CIPHER_CTX_is_encrypting(ctx))
+    return lean_io_result_mk_error(lean_mk_io_user_error(lean_mk_string("crypto_aead_seal_final: the Aead decrypts")));
+  // the AEADs accepted by `crypto_aead_new` output nothing here
+  unsigned char rest[EVP_MAX_BLOCK_LENGTH];
+  int n = 0;
+  unsigned char tag[AEAD_TAG_LEN];
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_construct_octet_string(OSSL_CIPHER_PARAM_AEAD_TAG, tag, AEAD_TAG_LEN),
+    OSSL_PARAM_construct_end(),
+  };
+  ERR_clear_error();
+  if (!EVP_CipherFinal_ex(ctx, rest, &n) || !EVP_CIPHER_CTX_get_params(ctx, params))
+    return lean_io_result_mk_error(error_to_io_user_error());
+  return lean_io_result_mk_ok(mk_byte_array(tag, AEAD_TAG_LEN));
+}
+
+// @& Aead -> @& ByteArray -> IO Bool
+extern "C" lean_obj_res crypto_aead_open_final(b_lean_obj_arg aead, b_lean_obj_arg tag)
+{
+  EVP_CIPHER_CTX * ctx = unwrapEC<EVP_CIPHER_CTX *>(aead);
+  if (EVP_CIPHER_CTX_is_encrypting(ctx))
+    return lean_io_result_mk_error(lean_mk_io_user_error(lean_mk_string("crypto_aead_open_final: the Aead encrypts")));
+  if (lean_sarray_size(tag) != AEAD_TAG_LEN)
+    return lean_io_result_mk_ok(lean_box(false));
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_construct_octet_string(OSSL_CIPHER_PARAM_AEAD_TAG, const_cast<uint8_t *>(lean_sarray_cptr(tag)),
+                                      lean_sarray_size(tag)),
+    OSSL_PARAM_construct_end(),
+  };
+  ERR_clear_error();
+  if (!EVP_CIPHER_CTX_set_params(ctx, params))
+    return lean_io_result_mk_error(error_to_io_user_error());
+  unsigned char rest[EVP_MAX_BLOCK_LENGTH];
+  int n = 0;
+  bool ok = EVP_CipherFinal_ex(ctx, rest, &n);
+  // a wrong tag only leaves an error on the queue
+  ERR_clear_error();
+  return lean_io_result_mk_ok(lean_box(ok));
+}
+
+// OpenSSL heap accounting. Every block carries a header with its size so frees can be accounted.
+struct alignas(16) AllocHeader
+{
+  size_t size;
+};
+
+static std::atomic<uint64_t> crypto_alloc_count{0};
+static std::atomic<uint64_t> crypto_alloc_bytes{0};
+static std::atomic<uint64_t> crypto_live_bytes{0};
+
+static void *counting_malloc(size_t n, const char *file, int line)
+{
+  auto h = static_cast<AllocHeader *>(std::malloc(sizeof(AllocHeader) + n));
+  if (h == nullptr)
+    return nullptr;
+  h->size = n;
+  crypto_alloc_count.fetch_add(1, std::memory_order_relaxed);
+  crypto_alloc_bytes.fetch_add(n, std::memory_order_relaxed);
+  crypto_live_bytes.fetch_add(n, std::memory_order_relaxed);
+  return h + 1;
+}
+
+static void counting_free(void *p, const char *file, int line)
+{
+  if (p == nullptr)
+    return;
+  auto h = static_cast<AllocHeader *>(p) - 1;
+  crypto_live_bytes.fetch_sub(h->size, std::memory_order_relaxed);
+  std::free(h);
+}
+
+static void *counting_realloc(void *p, size_t n, const char *file, int line)
+{
+  if (p == nullptr)
+    return counting_malloc(n, file, line);
+  auto h = static_cast<AllocHeader *>(p) - 1;
+  size_t old = h->size;
+  auto h2 = static_cast<AllocHeader *>(std::realloc(h, sizeof(AllocHeader) + n));
+  if (h2 == nullptr)
+    return nullptr;
+  h2->size = n;
+  crypto_alloc_count.fetch_add(1, std::memory_order_relaxed);
+  crypto_alloc_bytes.fetch_add(n, std::memory_order_relaxed);
+  crypto_live_bytes.fetch_add(n, std::memory_order_relaxed);
+  crypto_live_bytes.fetch_sub(old, std::memory_order_relaxed);
+  return h2 + 1;
+}
+
+// BaseIO Bool
+// OpenSSL only accepts custom allocators before its first allocation.
+extern "C" uint8_t crypto_enable_alloc_stats()
+{
+  return CRYPTO_set_mem_functions(counting_malloc, counting_realloc, counting_free) == 1;
+}
+
+// BaseIO AllocStats
+extern "C" lean_obj_res crypto_alloc_stats()
+{
+  lean_object *o = lean_alloc_ctor(0, 0, 3 * sizeof(uint64_t));
+  lean_ctor_set_uint64(o, 0, crypto_alloc_count.load(std::memory_order_relaxed));
+  lean_ctor_set_uint64(o, sizeof(uint64_t), crypto_alloc_bytes.load(std::memory_order_relaxed));
+  lean_ctor_set_uint64(o, 2 * sizeof(uint64_t), crypto_live_bytes.load(std::memory_order_relaxed));
+  return o;
+}
@@ -0,0 +1,114 @@
+module
+
+public import Tls.Connection
+public import Tls.Context
+
+open Tls.Internal.FFI
+open Std.Internal.IO.Async
+
+public section
+
+namespace Tls
+
+/--
+Limits of a `Pool`.
+* `maxSize` bounds the idle connections over all keys, `maxIdlePerKey` those of one key.
+  A connection returned to a full pool is shut down.
+* Idle connections older than `idleTimeoutMs` are shut down instead of reused.
+-/
+structure PoolConfig where
+  maxSize : Nat := 64
+  maxIdlePerKey : Nat := 16
+  idleTimeoutMs : Nat := 60_000
+  deriving Repr, Inhabited
+
+/--
+What a pooled connection can be reused for. `host` is the SNI, or the address without SNI.
+`config` is the client configuration the connection was opened with,
+so a connection is never handed to a client with different verification or ALPN settings.
+-/
+structure PoolKey where
+  host : String
+  port : UInt16
+  config : ContextConfig
+  deriving BEq, Hashable, Repr, Inhabited
+
+def PoolKey.ofAddr (addr : Std.Net.SocketAddress) (serverName? : Option String) (config : ContextConfig) :
+    PoolKey :=
+  let (host, port) := match addr with
+    | .v4 a => (toString a.addr, a.port)
+    | .v6 a => (toString a.addr, a.port)
+  { host := serverName?.getD host, port, config }
+
+/--
+Idle TLS connections kept for reuse, see `Http.Transport.tls`.
+Clients with different TLS settings can share a pool, their connections are kept apart by `PoolKey.config`.
+-/
+structure Pool where
+  config : PoolConfig
+  /-- Per key, the idle connections with the `IO.monoMsNow` they were returned at, oldest first. -/
+  idle : IO.Ref (Std.HashMap PoolKey (Array (Connection × Nat)))
+
+def Pool.new (config : PoolConfig := {}) : BaseIO Pool := do
+  return { config, idle := ← IO.mkRef {} }
+
+/-- Number of idle connections over all keys. -/
+def Pool.size (pool : Pool) : BaseIO Nat := do
+  return (← pool.idle.get).fold (fun n _ conns => n + conns.size) 0
+
+private def Pool.expired (pool : Pool) (now since : Nat) : Bool :=
+  now - since ≥ pool.config.idleTimeoutMs
+
+private def closeQuietly (conn : Connection) : Async Unit := do
+  try conn.shutdown catch _ => pure ()
+
+/--
+Take the most recently returned connection for `key` that is neither expired nor fails `BIO.idle_check`.
+The stale ones met on the way are shut down.
+-/
+partial def Pool.checkout? (pool : Pool) (key : PoolKey) : Async (Option Connection) := do
+  let entry? ← pool.idle.modifyGet fun m =>
+    match m[key]?.bind (·.back?) with
+    | some entry =>
+      let conns := (m.getD key #[]).pop
+      (some entry, if conns.isEmpty then m.erase key else m.insert key conns)
+    | none => (none, m)
+  let some (conn, since) := entry? | return none
+  if pool.expired (← IO.monoMsNow) since || !(← conn.bio.idle_check) then
+    closeQuietly conn
+    pool.checkout? key
+  else
+    return some conn
+
+/-- Return a connection after use. It is kept if it passes `BIO.idle_check` and the pool has room. -/
+def Pool.checkin (pool : Pool) (key : PoolKey) (conn : Connection) : Async Unit := do
+  if ← conn.bio.idle_check then
+    let now ← IO.monoMsNow
+    let kept ← pool.idle.modifyGet fun m =>
+      let conns := m.getD key #[]
+      let total := m.fold (fun n _ conns => n + conns.size) 0
+      if total < pool.config.maxSize && conns.size < pool.config.maxIdlePerKey then
+        (true, m.insert key (conns.push (conn, now)))
+      else
+        (false, m)
+    if kept then
+      return
+  closeQuietly conn
+
+/-- Shut down the idle connections that outlived `idleTimeoutMs`. `checkout?` only does so for its own key. -/
+def Pool.prune (pool : Pool) : Async Unit := do
+  let now ← IO.monoMsNow
+  let stale ← pool.idle.modifyGet fun m =>
+    m.fold (init := (#[], m)) fun (stale, m) key conns =>
+      let (old, fresh) := conns.partition fun (_, since) => pool.expired now since
+      (stale ++ old, if fresh.isEmpty then m.erase key else m.insert key fresh)
+  for (conn, _) in stale do
+    closeQuietly conn
+
+/-- Shut down all idle connections. -/
+def Pool.clear (pool : Pool) : Async Unit := do
+  let all ← pool.idle.modifyGet fun m => (m.fold (fun acc _ conns => acc ++ conns) #[], {})
+  for (conn, _) in all do
+    closeQuietly conn
+
+end Tls
@@ -0,0 +1,104 @@
+module
+
+public import Tls.Internal.FFI
+public import Tls.Context
+
+open Tls.Internal.FFI
+
+public section
+
+namespace Tls
+
+/-- Where a server certificate comes from. -/
+inductive ServerCert where
+  /-- PEM files: the leaf certificate followed by its intermediates, and the private key. -/
+  | files (certChainFile privateKeyFile : String)
+  /-- A freshly generated self-signed certificate, for tests and benchmarks. -/
+  | selfSigned (commonName : String)
+  deriving BEq, Hashable, Repr, Inhabited
+
+/--
+Everything that determines how a server `SSLContext` is configured.
+* `cert` is used when the client sends no SNI, or a name without its own certificate.
+* `sniCerts` maps server names to certificates, see `SSLContext.add_sni_context`.
+* `alpnProtocols` are selected from in order of preference.
+* `protocol` bounds versions and orders ciphers and groups, see `ProtocolConfig`.
+* `records` sizes records and read-ahead, see `RecordConfig`.
+* `lowMemory` is for servers holding many idle connections, see `SSLContext.set_low_memory`.
+* `maxEarlyData` bytes of 0-RTT data are accepted on resumed connections, see `SSLContext.set_max_early_data`.
+  Handlers find them in `Connection.earlyData`.
+  Contexts from `buildShards` share ticket keys and so cannot detect replays, see `SSLContext.set_ticket_keys`.
+-/
+structure ServerConfig where
+  cert : ServerCert
+  sniCerts : Array (String × ServerCert) := #[]
+  alpnProtocols : Array String := #[]
+  cipherList? : Option String := none
+  cipherSuites? : Option String := none
+  protocol : ProtocolConfig := {}
+  records : RecordConfig := {}
+  lowMemory : Bool := false
+  maxEarlyData : UInt32 := 0
+  deriving BEq, Hashable, Repr, Inhabited
+
+/-- A context without a certificate. Everything else is the same for all contexts of one config. -/
+private def ServerConfig.buildBare (cfg : ServerConfig) : IO SSLContext := do
+  let ctx ← SSLContext.new (← SSLMethod.TLS)
+  cfg.protocol.apply ctx (server := true)
+  if let some ciphers := cfg.cipherList? then
+    ctx.set_cipher_list ciphers
+  if let some suites := cfg.cipherSuites? then
+    ctx.set_ciphersuites suites
+  -- the context selected by SNI is the one that negotiates ALPN
+  unless cfg.alpnProtocols.isEmpty do
+    ctx.set_alpn_select_protocols cfg.alpnProtocols
+  cfg.records.apply ctx
+  if cfg.lowMemory then
+    ctx.set_low_memory true
+  if cfg.maxEarlyData > 0 then
+    ctx.set_max_early_data cfg.maxEarlyData
+  return ctx
+
+private def ServerConfig.buildFor (cfg : ServerConfig) (cert : ServerCert) : IO SSLContext := do
+  let ctx ← cfg.buildBare
+  match cert with
+  | .files chain key =>
+    ctx.use_certificate_chain_file chain
+    ctx.use_private_key_file key
+  | .selfSigned commonName =>
+    ctx.use_self_signed commonName
+  return ctx
+
+/-- Build the default context, with one more context per SNI certificate attached to it. -/
+def ServerConfig.build (cfg : ServerConfig) : IO SSLContext := do
+  let ctx ← cfg.buildFor cfg.cert
+  for (name, cert) in cfg.sniCerts do
+    ctx.add_sni_context name (← cfg.buildFor cert)
+  return ctx
+
+/--
+Build `shards` default contexts of one server, one per accept loop, see `Tls.serveShards`.
+They share the loaded certificates, the SNI contexts and `ticketKeys`, but no session cache,
+so handshakes on different shards do not contend inside OpenSSL,
+and a session resumes on whichever shard the client lands on.
+-/
+def ServerConfig.buildShards (cfg : ServerConfig) (shards : Nat) (ticketKeys : TicketKeys) :
+    IO (Array SSLContext) := do
+  let first ← cfg.buildFor cfg.cert
+  let sni ← cfg.sniCerts.mapM fun (name, cert) => do
+    let ctx ← cfg.buildFor cert
+    ctx.set_ticket_keys ticketKeys
+    return (name, ctx)
+  let mut out := #[]
+  for i in [0:max shards 1] do
+    let ctx ← if i == 0 then pure first else do
+      let ctx ← cfg.buildBare
+      ctx.share_certificate first
+      pure ctx
+    ctx.set_ticket_keys ticketKeys
+    for (name, sniCtx) in sni do
+      ctx.add_sni_context name sniCtx
+    out := out.push ctx
+  return out
+
+end Tls
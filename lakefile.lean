@@ -160,4 +160,9 @@ lean_exe "tls" where
   root := `Main
   supportInterpreter := true
 
+/-- Loopback benchmarks, one JSON result per line. -/
+lean_exe "tls-bench" where
+  root := `Bench
+  supportInterpreter := true
+
 require http from git "https://github.com/Qiu233/http"